@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+#include <benchmark/benchmark.h>
+
+namespace obd2 {
+    // Number of allocations made through operator new by any thread of the process so far
+    uint64_t allocation_count();
+
+    // Reports the allocations made since start as allocs/op. Threads of the library running in the
+    // background are counted as well, so benchmarks keep them idle while measuring.
+    inline void report_allocations(benchmark::State &state, uint64_t start) {
+        state.counters["allocs/op"] = benchmark::Counter(
+            static_cast<double>(allocation_count() - start), 
+            benchmark::Counter::kAvgIterations
+        );
+    }
+}
@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "alloc_counter.h"
+#include "obd2.h"
+#include "sim_ecu.h"
+
+namespace obd2 {
+    namespace {
+        void BM_dtc_str(benchmark::State &state) {
+            dtc d(0x4301, dtc::STORED);
+            uint64_t start = allocation_count();
+
+            for (auto _ : state) {
+                benchmark::DoNotOptimize(d.str());
+            }
+
+            report_allocations(state, start);
+        }
+
+        // decode_dtcs is only reachable through get_dtcs, so the three requests to the ECU are part of each
+        // iteration. The ECU reports range(0) stored DTCs.
+        void BM_decode_dtcs(benchmark::State &state) {
+            std::shared_ptr<sim_ecu> engine = sim_engine();
+            engine->stored_dtcs.clear();
+
+            for (int64_t i = 0; i < state.range(0); i++) {
+                engine->stored_dtcs.push_back(static_cast<uint8_t>(0x01 + i));
+                engine->stored_dtcs.push_back(0x43);
+            }
+
+            obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 1000);
+            instance.wait_for_connection_state(obd2::CONNECTED, 5000);
+
+            uint64_t start = allocation_count();
+
+            for (auto _ : state) {
+                benchmark::DoNotOptimize(instance.get_dtcs(engine->id));
+            }
+
+            report_allocations(state, start);
+        }
+    }
+
+    BENCHMARK(BM_dtc_str);
+    BENCHMARK(BM_decode_dtcs)->Arg(1)->Arg(16)->Arg(120);
+}
@@ -0,0 +1,108 @@
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "alloc_counter.h"
+#include "obd2.h"
+
+namespace obd2 {
+    namespace {
+        // Formulas of common SAE J1979 PIDs and one that does not fit the affine form
+        const std::array<std::string, 6> formulas = {
+            "A",
+            "A-40",
+            "A*100/255",
+            "(256*A+B)/4",
+            "(256*A+B)/1000",
+            "A*B/(C+1)-D^2",
+        };
+
+        const std::vector<uint8_t> input = { 0x1A, 0xF8, 0x32, 0x07 };
+
+        void BM_math_expr_parse(benchmark::State &state) {
+            const std::string &formula = formulas[state.range(0)];
+            uint64_t start = allocation_count();
+
+            for (auto _ : state) {
+                math_expr e(formula);
+                benchmark::DoNotOptimize(e);
+            }
+
+            report_allocations(state, start);
+            state.SetLabel(formula);
+        }
+
+        void BM_math_expr_solve(benchmark::State &state) {
+            math_expr e(formulas[state.range(0)]);
+            uint64_t start = allocation_count();
+
+            for (auto _ : state) {
+                benchmark::DoNotOptimize(e.solve(input));
+            }
+
+            report_allocations(state, start);
+            state.SetLabel(formulas[state.range(0)]);
+        }
+
+        // Copying a request copies its formula
+        void BM_math_expr_copy(benchmark::State &state) {
+            math_expr e(formulas[state.range(0)]);
+            uint64_t start = allocation_count();
+
+            for (auto _ : state) {
+                math_expr copy(e);
+                benchmark::DoNotOptimize(copy);
+            }
+
+            report_allocations(state, start);
+            state.SetLabel(formulas[state.range(0)]);
+        }
+
+        // Solves range(1) packed samples of 4 bytes, one by one or as a batch
+        void solve_samples(benchmark::State &state, bool batch) {
+            math_expr e(formulas[state.range(0)]);
+            size_t count = static_cast<size_t>(state.range(1));
+            std::vector<uint8_t> samples(count * 4);
+            std::vector<float> results(count);
+
+            for (size_t i = 0; i < samples.size(); i++) {
+                samples[i] = static_cast<uint8_t>(i * 7);
+            }
+
+            for (auto _ : state) {
+                if (batch) {
+                    e.solve_batch(samples.data(), 4, 4, count, results.data());
+                }
+                else {
+                    for (size_t i = 0; i < count; i++) {
+                        results[i] = e.solve(std::span<const uint8_t>(samples.data() + i * 4, 4));
+                    }
+                }
+
+                benchmark::DoNotOptimize(results.data());
+                benchmark::ClobberMemory();
+            }
+
+            state.SetItemsProcessed(state.iterations() * state.range(1));
+            state.SetLabel(formulas[state.range(0)]);
+        }
+
+        void BM_math_expr_solve_loop(benchmark::State &state) {
+            solve_samples(state, false);
+        }
+
+        void BM_math_expr_solve_batch(benchmark::State &state) {
+            solve_samples(state, true);
+        }
+    }
+
+    BENCHMARK(BM_math_expr_parse)->DenseRange(0, formulas.size() - 1);
+    BENCHMARK(BM_math_expr_solve)->DenseRange(0, formulas.size() - 1);
+    BENCHMARK(BM_math_expr_copy)->DenseRange(0, formulas.size() - 1);
+    BENCHMARK(BM_math_expr_solve_loop)->ArgsProduct({ { 1, 3, 5 }, { 4096 } });
+    BENCHMARK(BM_math_expr_solve_batch)->ArgsProduct({ { 1, 3, 5 }, { 8, 64, 4096, 65536 } });
+}
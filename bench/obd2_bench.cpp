@@ -0,0 +1,138 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "alloc_counter.h"
+#include "obd2.h"
+#include "sim_ecu.h"
+
+namespace obd2 {
+    namespace {
+        const uint8_t chain_pids[] = { 0x04, 0x05, 0x0B, 0x0D, 0x0F, 0x11 };
+
+        // Reads the value of one of range(0) requests chained into the same combination. The requests are
+        // refreshed once per second, so the listener stays idle while measuring.
+        void BM_get_data(benchmark::State &state) {
+            std::shared_ptr<sim_ecu> engine = sim_engine();
+            obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 1000, true);
+            instance.wait_for_connection_state(obd2::CONNECTED, 5000);
+
+            std::list<request> requests;
+
+            for (int64_t i = 0; i < state.range(0); i++) {
+                requests.emplace_back(engine->id, 0x01, chain_pids[i], instance, "A*100/255", true);
+            }
+
+            // Wait for the first refresh of every request
+            auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+            for (request &r : requests) {
+                while (std::isnan(r.get_value()) && std::chrono::steady_clock::now() < timeout) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+
+            request &r = requests.back();
+            uint64_t start = allocation_count();
+
+            for (auto _ : state) {
+                benchmark::DoNotOptimize(r.get_value());
+            }
+
+            report_allocations(state, start);
+            state.counters["transactions/cycle"] = instance.get_transactions_per_cycle();
+        }
+
+        // Adds range(0) chained requests, spread over 8 ECUs and both services that allow chaining, and removes
+        // them again. Each ECU and service gets range(0) / 16 pids.
+        void BM_add_requests(benchmark::State &state) {
+            std::vector<std::shared_ptr<sim_ecu>> ecus;
+
+            for (uint32_t id = 0x7E0; id < 0x7E8; id++) {
+                ecus.push_back(sim_engine(id));
+            }
+
+            obd2 instance(std::make_unique<loopback_transport>(sim_handler(ecus)), 1000, true);
+            instance.wait_for_connection_state(obd2::CONNECTED, 5000);
+
+            for (auto _ : state) {
+                std::list<request> requests;
+
+                for (int64_t i = 0; i < state.range(0); i++) {
+                    uint32_t ecu_id = 0x7E0 + i % 8;
+                    uint8_t service = (i / 8) % 2 ? 0x02 : 0x01;
+                    uint16_t pid = static_cast<uint16_t>(0x20 + i / 16);
+
+                    requests.emplace_back(ecu_id, service, pid, instance, "A", true);
+                }
+
+                state.PauseTiming();
+                requests.clear();
+                state.ResumeTiming();
+            }
+
+            state.SetItemsProcessed(state.iterations() * state.range(0));
+        }
+
+        // Achieved rates of signals with different requested rates on one ECU, reported as <signal>@<requested>.
+        // The protocol refreshes at 10 Hz, which the speed keeps by leaving its own rate at 0.
+        void BM_refresh_rates(benchmark::State &state) {
+            struct signal {
+                std::string name;
+                uint16_t pid;
+                uint32_t refresh_ms;
+                std::atomic<uint64_t> samples = 0;
+            };
+
+            std::shared_ptr<sim_ecu> engine = sim_engine();
+            obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 100);
+            instance.wait_for_connection_state(obd2::CONNECTED, 5000);
+
+            std::list<signal> signals;
+            signals.emplace_back("rpm@20Hz", 0x0C, 50);
+            signals.emplace_back("speed@10Hz", 0x0D, 0);
+            signals.emplace_back("throttle@100Hz", 0x11, 10);
+            signals.emplace_back("coolant@0.2Hz", 0x05, 5000);
+
+            std::list<request> requests;
+
+            for (signal &s : signals) {
+                request &r = requests.emplace_back(engine->id, 0x01, s.pid, instance, "A", true);
+                r.set_refresh_ms(s.refresh_ms);
+                r.subscribe([&s](const request::sample &) { s.samples++; });
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (auto _ : state) {
+                std::this_thread::sleep_for(std::chrono::seconds(3));
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            uint64_t misses = 0;
+
+            for (request &r : requests) {
+                misses += r.get_deadline_misses();
+                r.stop();
+            }
+
+            for (signal &s : signals) {
+                state.counters[s.name] = static_cast<double>(s.samples) / seconds;
+            }
+
+            state.counters["misses"] = static_cast<double>(misses);
+        }
+    }
+
+    BENCHMARK(BM_get_data)->Arg(1)->Arg(6);
+    BENCHMARK(BM_add_requests)->Arg(1000)->Arg(3000)->UseRealTime()->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_refresh_rates)->Iterations(1)->UseRealTime()->Unit(benchmark::kMillisecond);
+}
@@ -0,0 +1,206 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "alloc_counter.h"
+#include "obd2.h"
+#include "sim_ecu.h"
+
+namespace obd2 {
+    namespace {
+        std::chrono::microseconds cpu_time() {
+            timespec ts;
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+            return std::chrono::seconds(ts.tv_sec) + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(ts.tv_nsec));
+        }
+
+        // Starts range(0) cyclic commands, spread over the sockets of the 8 standard ECUs
+        std::list<command> start_load(protocol &p, int64_t count) {
+            std::list<command> commands;
+
+            for (int64_t i = 0; i < count; i++) {
+                uint32_t tx_id = 0x7E0 + i % 8;
+                commands.emplace_back(tx_id, tx_id + 0x08, 0x01, static_cast<uint16_t>(1 + i / 8), p, true);
+            }
+
+            return commands;
+        }
+
+        uint64_t response_count(std::list<command> &commands) {
+            uint64_t count = 0;
+
+            for (command &c : commands) {
+                count += c.get_view().get_generation();
+            }
+
+            return count;
+        }
+
+        // Round trip of a one shot command through process_socket, while range(0) other backends are indexed on
+        // the same socket. The other backends are stopped after their first response, so only the one shot
+        // command is on the bus while measuring.
+        void BM_process_socket(benchmark::State &state) {
+            protocol p(std::make_unique<loopback_transport>(echo_handler), 1000);
+            std::list<command> backends;
+
+            // Responses only carry 8 bit PIDs, so the backends are spread over several services
+            for (int64_t i = 0; i < state.range(0); i++) {
+                uint8_t sid = static_cast<uint8_t>(0x10 + i / 0x100);
+                command &c = backends.emplace_back(0x7E0, 0x7E8, sid, static_cast<uint16_t>(i % 0x100), p, true);
+                c.stop();
+            }
+
+            for (command &c : backends) {
+                c.wait_for_response();
+            }
+
+            uint64_t start = allocation_count();
+
+            for (auto _ : state) {
+                command c(0x7E0, 0x7E8, 0x01, 0x0C, p);
+                benchmark::DoNotOptimize(c.wait_for_response());
+            }
+
+            report_allocations(state, start);
+        }
+
+        // CPU time the listener uses while range(0) cyclic commands are refreshed every millisecond, or once per
+        // second without commands. The main thread only sleeps, so the CPU time of the process is the listener's.
+        void BM_listener_load(benchmark::State &state) {
+            protocol p(std::make_unique<loopback_transport>(echo_handler), state.range(0) ? 1 : 1000);
+            std::list<command> commands = start_load(p, state.range(0));
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            uint64_t responses = response_count(commands);
+            std::chrono::microseconds cpu_start = cpu_time();
+            auto start = std::chrono::steady_clock::now();
+
+            for (auto _ : state) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            double cpu_us = static_cast<double>((cpu_time() - cpu_start).count());
+
+            responses = response_count(commands) - responses;
+
+            state.counters["cpu_us/s"] = cpu_us / seconds;
+            state.counters["responses/s"] = static_cast<double>(responses) / seconds;
+            state.counters["cpu_us/response"] = responses ? cpu_us / static_cast<double>(responses) : 0.0;
+        }
+
+        // Round trip of a one shot command while range(0) cyclic commands are refreshed every millisecond
+        void BM_listener_latency(benchmark::State &state) {
+            protocol p(std::make_unique<loopback_transport>(echo_handler), 1);
+            std::list<command> commands = start_load(p, state.range(0));
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            for (auto _ : state) {
+                command c(0x7E0, 0x7E8, 0x09, 0x02, p);
+                benchmark::DoNotOptimize(c.wait_for_response());
+            }
+        }
+
+        // One shot commands sent from many threads at once. Threads share the 8 standard ECUs, so identical
+        // commands of several threads are answered by one backend and responses can complete it before it is sent.
+        void BM_concurrent_one_shots(benchmark::State &state) {
+            static std::unique_ptr<protocol> p;
+
+            if (state.thread_index() == 0) {
+                p = std::make_unique<protocol>(std::make_unique<loopback_transport>(echo_handler), 1000);
+            }
+
+            uint32_t tx_id = 0x7E0 + state.thread_index() % 8;
+            uint64_t failed = 0;
+
+            for (auto _ : state) {
+                command c(tx_id, tx_id + 0x08, 0x01, 0x0C, *p);
+                failed += c.wait_for_response() != cmd_status::OK;
+            }
+
+            state.counters["failed"] = benchmark::Counter(static_cast<double>(failed), benchmark::Counter::kAvgThreads);
+
+            if (state.thread_index() == 0) {
+                p.reset();
+            }
+        }
+
+        // Samples per second of range(0) ECUs that each answer after 2 ms, with one cyclic command per ECU.
+        // Sending one command at a time would be limited to 500 samples per second, whatever the ECU count.
+        void BM_pipelined_ecus(benchmark::State &state) {
+            std::vector<std::shared_ptr<sim_ecu>> ecus;
+
+            for (int64_t i = 0; i < state.range(0); i++) {
+                ecus.push_back(sim_engine(0x7E0 + i));
+                ecus.back()->latency = std::chrono::milliseconds(2);
+            }
+
+            protocol p(std::make_unique<loopback_transport>(sim_handler(ecus)), 1);
+            std::list<command> commands;
+
+            for (std::shared_ptr<sim_ecu> &e : ecus) {
+                commands.emplace_back(e->id, e->id + 0x08, 0x01, 0x0C, p, true);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            uint64_t samples = response_count(commands);
+            auto start = std::chrono::steady_clock::now();
+
+            for (auto _ : state) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            state.counters["samples/s"] = static_cast<double>(response_count(commands) - samples) / seconds;
+        }
+
+        // Samples per second of an ECU that answers after 2 ms and loses every third response. range(0) selects a
+        // fixed timeout of one second or timeouts learned from the round trip times with a floor of 10 ms.
+        void BM_lossy_ecu(benchmark::State &state) {
+            std::shared_ptr<sim_ecu> engine = sim_engine();
+            engine->latency = std::chrono::milliseconds(2);
+            engine->drop_every = 3;
+
+            protocol p(std::make_unique<loopback_transport>(sim_handler({ engine })), 10);
+            p.set_response_timeout(state.range(0) ? 10 : 1000, 1000);
+
+            // The response of a command is cleared when it times out, so the responses are counted as they arrive
+            std::atomic<uint64_t> samples = 0;
+
+            command c(engine->id, engine->id + 0x08, 0x01, 0x0D, p, true);
+            c.set_response_cb([&](uint32_t, uint64_t, std::chrono::steady_clock::time_point) { samples++; });
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (auto _ : state) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            rtt_estimator rtt = p.get_rtt(engine->id, engine->id + 0x08);
+
+            state.counters["samples/s"] = static_cast<double>(samples) / seconds;
+            state.counters["srtt_us"] = static_cast<double>(rtt.get_srtt().count());
+            state.counters["timeouts"] = rtt.get_timeout_count();
+        }
+    }
+
+    BENCHMARK(BM_process_socket)->Arg(10)->Arg(100)->Arg(1000)->UseRealTime();
+    BENCHMARK(BM_listener_load)->Arg(0)->Arg(8)->Arg(64)->Iterations(10)->UseRealTime()->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_concurrent_one_shots)->ThreadRange(1, 64)->UseRealTime()->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_listener_latency)->Arg(0)->Arg(8)->Arg(64)->UseRealTime()->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_lossy_ecu)->ArgName("adaptive")->Arg(0)->Arg(1)->Iterations(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_pipelined_ecus)->DenseRange(1, 8)->Iterations(10)->UseRealTime()->Unit(benchmark::kMillisecond);
+}
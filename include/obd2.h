@@ -1,24 +1,46 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "../src/discovery_cache/discovery_cache.h"
 #include "../src/dtc/dtc.h"
 #include "../src/ecu/ecu.h"
 #include "../src/protocol/command/command.h"
+#include "../src/protocol/command/response_view/response_view.h"
 #include "../src/protocol/protocol.h"
+#include "../src/protocol/transport/isotp/isotp_transport.h"
+#include "../src/protocol/transport/loopback/loopback_transport.h"
 #include "../src/req_combination/req_combination.h"
 #include "../src/request/request.h"
+#include "../src/sample_history/sample_history.h"
 #include "../src/vehicle_info/vehicle_info.h"
 
 namespace obd2 {
     class obd2 {
         public:
+            enum connection_state {
+                DISCONNECTED,
+                DISCOVERING,
+                CONNECTED
+            };
+
             obd2();
             obd2(const char *if_name, uint32_t refresh_ms = 1000, bool enable_pid_chaining = false);
+            obd2(std::unique_ptr<transport> transport_instance, uint32_t refresh_ms = 1000, bool enable_pid_chaining = false);
             obd2(const obd2 &i) = delete;
             obd2(obd2 &&i);
             ~obd2();
@@ -26,20 +48,32 @@ namespace obd2 {
             obd2 &operator=(const obd2 &i) = delete;
             obd2 &operator=(obd2 &&i);
 
-            bool is_connection_active();
+            bool is_connection_active() const;
+            connection_state get_connection_state() const;
+            bool wait_for_connection_state(connection_state state, uint32_t timeout_ms);
             
             std::vector<uint8_t> get_supported_pids(uint32_t ecu_id, uint8_t service);
             bool pid_supported(uint32_t ecu_id, uint8_t service, uint16_t pid);
             std::vector<dtc> get_dtcs(uint32_t ecu_id);
+            std::unordered_map<uint32_t, std::vector<dtc>> get_dtcs(const std::vector<uint32_t> &ecu_ids);
+            std::unordered_map<uint32_t, std::vector<dtc>> get_all_dtcs();
             void clear_dtcs(uint32_t ecu_id);
-            const vehicle_info &get_vehicle_info();
-            std::vector<std::reference_wrapper<ecu>> get_ecus();
+            vehicle_info get_vehicle_info();
+            std::vector<ecu> get_ecus();
             
             void set_refreshed_cb(const std::function<void(void)> &cb);
             void set_enable_pid_chaining(bool enable_pid_chaining);
             void set_refresh_ms(uint32_t refresh_ms);
+            void set_response_timeout(uint32_t floor_ms, uint32_t ceiling_ms);
+            // Restores the ECUs and vehicle info of known vehicles from the file instead of discovering them, empty disables
+            void set_discovery_cache(const std::string &path);
 
             uint32_t get_refresh_ms() const;
+            rtt_estimator get_ecu_rtt(uint32_t ecu_id);
+            // Requests sent to the vehicle per refresh cycle, after chaining
+            double get_transactions_per_cycle();
+            // Subscription notifications dropped because the dispatcher fell behind
+            uint64_t get_dropped_notifications() const;
         
         private:
             // TODO: Enums for service and pids
@@ -49,27 +83,134 @@ namespace obd2 {
             static constexpr uint32_t ECU_ID_RES_OFFSET = 0x08;
 
             static constexpr uint8_t PID_SUPPORT_RANGE  = 0x20;
+            static constexpr size_t PID_SUPPORT_RANGE_COUNT = 8;
+
+            using pid_bitmaps = std::array<uint32_t, PID_SUPPORT_RANGE_COUNT>; // Support bitmap of each PID range
+
+            // Time other ECUs get to answer a broadcast after the first response, the maximum P2 time of ISO 15765-4
+            static constexpr uint32_t BROADCAST_SETTLE_MS = 50;
+
+            // Time all ECUs together get to answer the DTC requests, ECUs that are not present never answer
+            static constexpr uint32_t DTC_TIMEOUT_MS = 5000;
+
+            // VIN of the vehicle info if it could not be read
+            static constexpr const char *VIN_UNKNOWN = "Unkonwn";
 
             protocol protocol_instance;
             bool enable_pid_chaining = false;
 
-            std::list<req_combination> req_combinations;
+            static constexpr size_t MAX_CHAINED_PIDS    = 6;
+
+            // Responses longer than a single frame are sent as a first frame, a flow control frame and consecutive frames
+            static constexpr size_t ISOTP_SINGLE_FRAME_SIZE      = 7;
+            static constexpr size_t ISOTP_FIRST_FRAME_SIZE       = 6;
+            static constexpr size_t ISOTP_CONSECUTIVE_FRAME_SIZE = 7;
+            // Cost of each frame after the first relative to a whole transaction, which also has to wait for the ECU
+            static constexpr double CHAINED_FRAME_COST = 0.25;
+            // Transactions per cycle a repack has to save, guards against float inaccuracy
+            static constexpr double REPACK_MIN_SAVING = 1e-6;
+
+            // Parameters that identify a request, no two requests may share them
+            struct request_key {
+                uint32_t ecu_id;
+                uint8_t service;
+                uint16_t pid;
+                std::string formula;
+
+                bool operator==(const request_key &k) const = default;
+            };
+
+            struct request_key_hash {
+                size_t operator()(const request_key &k) const;
+            };
+
+            std::mutex requests_mutex; // Guards the combinations and subscriptions, as the dispatcher reads them
+            // Shared with the requests, so a reader keeps a combination alive that repacking erased meanwhile
+            std::list<std::shared_ptr<req_combination>> req_combinations;
             std::unordered_map<request *, std::reference_wrapper<req_combination>> req_combinations_map;
+            std::unordered_set<request_key, request_key_hash> request_keys;
+            std::unordered_map<req_combination *, std::list<std::shared_ptr<req_combination>>::iterator> combination_entries;
+            std::unordered_map<uint64_t, req_combination *> pid_combinations; // ECU ID, service and PID => combination containing the PID
+            std::unordered_map<uint64_t, std::vector<req_combination *>> chained_combinations; // ECU ID and service => combinations allowing chaining, oldest first
+            std::unordered_map<uint64_t, std::vector<req_combination *>> open_combinations; // ECU ID and service => chained combinations with room for more pids
+
+            static constexpr size_t SUBSCRIPTION_QUEUE_SIZE = 256;
+
+            // Positive response of a combination with subscribed requests
+            struct response_event {
+                req_combination *combination;
+                uint32_t rx_id;
+                uint64_t generation;
+                std::chrono::steady_clock::time_point recieved_at;
+            };
+
+            struct subscription {
+                uint32_t id;
+                std::shared_ptr<const request::subscription_cb> cb;
+            };
+
+            // What the listener needs to decode the sample of a request with a history
+            struct history_target {
+                uint16_t pid;
+                size_t size;
+                math_expr formula;
+                std::shared_ptr<sample_history> history;
+            };
+
+            // Data size of each pid of a command, so the listener finds the pids in a response without the combination
+            using pid_sizes = std::vector<std::pair<uint16_t, size_t>>;
+
+            std::unordered_map<request *, std::vector<subscription>> subscriptions;
+            uint32_t next_subscription_id = 1;
+            std::unordered_map<request *, std::shared_ptr<sample_history>> histories;
+
+            // The listener only queues responses, the dispatcher thread decodes them and calls the subscriptions.
+            // The queue is bounded, once it is full the oldest notification is dropped.
+            std::thread dispatcher_thread;
+            std::atomic<bool> dispatcher_running = false;
+            std::mutex dispatch_mutex;
+            std::condition_variable dispatch_cv;
+            std::array<response_event, SUBSCRIPTION_QUEUE_SIZE> dispatch_queue;
+            size_t dispatch_head = 0;
+            size_t dispatch_count = 0;
+            std::atomic<uint64_t> dropped_notifications = 0;
+            std::vector<std::pair<std::shared_ptr<const request::subscription_cb>, request::sample>> pending_calls; // Only used by the dispatcher
 
             std::unordered_map<uint32_t, ecu> ecus; // ECU ID => ECU
             vehicle_info vehicle;
 
-            std::mutex connection_mutex;
-            std::atomic<bool> last_connection_active = false;
-            std::atomic<uint8_t> connection_request_id = 0; // Used to identify connection requests results
+            static constexpr uint32_t HEARTBEAT_INTERVAL_MS      = 1000;
+            static constexpr uint32_t HEARTBEAT_PROBE_TIMEOUT_MS = 1000;
+
+            std::mutex connection_mutex; // Guards the ECUs, the vehicle info and the discovery cache
+            discovery_cache discovery;
+            std::atomic<connection_state> connection = DISCONNECTED;
+
+            // The heartbeat thread tracks the connection state and runs the discovery after connecting
+            std::thread heartbeat_thread;
+            std::atomic<bool> heartbeat_running = false;
+            std::mutex heartbeat_mutex;
+            std::condition_variable heartbeat_cv;
 
+            void start_heartbeat();
+            void stop_heartbeat();
+            void heartbeat();
+            void set_connection_state(connection_state state);
+            void discover();
+            bool load_discovery(discovery_cache &cache);
+
+            void setup_broadcast_group();
             bool query_connection_status();
-            void query_standard_ecus();
+            std::vector<uint32_t> query_responding_ecus();
+            std::unordered_map<uint32_t, ecu> query_standard_ecus();
             ecu query_ecu(uint32_t ecu_id, uint8_t query_service = 0x09);
-            void query_vehicle_info();
+            vehicle_info query_vehicle_info();
+            std::string query_info_string(uint32_t ecu_id, uint8_t pid, uint32_t timeout_ms = 5000);
             std::vector<uint8_t> get_supported_pids(uint32_t ecu_id, uint8_t service, bool cache);
             std::vector<uint8_t> get_supported_pids(uint32_t ecu_id, uint8_t service, uint8_t pid_offset);
-            std::vector<uint8_t> decode_pids_supported(const std::vector<uint8_t> &data, uint8_t pid_offset);
+            cmd_status query_supported_pids(uint32_t ecu_id, uint8_t service, std::vector<uint8_t> &pids);
+            static void read_pid_bitmaps(std::span<const uint8_t> data, pid_bitmaps &bitmaps);
+            static std::vector<uint8_t> decode_pids_supported(const pid_bitmaps &bitmaps);
             std::vector<dtc> decode_dtcs(const std::vector<uint8_t> &data, dtc::status status);
 
             void add_request(request &r);
@@ -77,9 +218,35 @@ namespace obd2 {
             void move_request(request &old_ref, request &new_ref);
             void stop_request(request &r);            
             void resume_request(request &r);
-            std::vector<uint8_t> get_data(request &r);
+            void update_refresh_ms(request &r);
+            uint64_t get_deadline_misses(request &r);
+            response_view get_data(request &r, uint32_t ecu_id = 0);
+            response_view get_data(request &r, req_combination &c, const response_view &data);
+            std::vector<uint32_t> get_responding_ecus(request &r);
 
             req_combination &get_combination(uint32_t ecu_id, uint8_t service, uint16_t pid, bool allow_pid_chain);     
+            req_combination &create_combination(uint32_t ecu_id, uint8_t service, uint16_t pid, bool allow_pid_chain);
+            void erase_combination(req_combination &c);
+            void update_open(req_combination &c);
+            void repack_combinations(uint32_t ecu_id, uint8_t service);
+            static double transaction_cost(size_t response_size);
+            req_combination &move_pid(uint16_t pid, req_combination &from, req_combination *to);
+            static uint64_t combination_key(uint32_t ecu_id, uint8_t service, uint16_t pid = 0);
+
+            uint32_t subscribe(request &r, const request::subscription_cb &cb);
+            void unsubscribe(request &r, uint32_t id);
+            void update_subscribed(req_combination &c);
+            void install_response_cb(req_combination &c);
+            void set_history_capacity(request &r, size_t capacity);
+            std::shared_ptr<const sample_history> get_history(request &r);
+            void record_history(req_combination &c, const std::vector<history_target> &targets, const pid_sizes &sizes, uint32_t rx_id, std::chrono::steady_clock::time_point recieved_at);
+            // Data of the pid in a chained response, empty if it is missing and none if a pid of the response has no size
+            static std::optional<response_view> find_pid_data(const response_view &data, const pid_sizes &sizes, uint16_t pid);
+            void start_dispatcher();
+            void stop_dispatcher();
+            void dispatcher();
+            void queue_response(req_combination &c, uint32_t rx_id, uint64_t generation, std::chrono::steady_clock::time_point recieved_at);
+            void dispatch_response(const response_event &event);
 
             friend class request;
     };
@@ -0,0 +1,162 @@
+#include "discovery_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace obd2 {
+    discovery_cache::discovery_cache() { }
+
+    discovery_cache::discovery_cache(const std::string &path) : path(path) { }
+
+    bool discovery_cache::is_enabled() const {
+        return !path.empty();
+    }
+
+    const std::string &discovery_cache::get_path() const {
+        return path;
+    }
+
+    bool discovery_cache::load(const std::string &vin, std::unordered_map<uint32_t, ecu> &ecus, vehicle_info &vehicle) const {
+        if (!is_enabled()) {
+            return false;
+        }
+
+        std::unordered_map<std::string, entry> entries = read_entries();
+        auto it = entries.find(vin);
+
+        if (it == entries.end() || it->second.ecus.empty()) {
+            return false;
+        }
+
+        ecus = std::move(it->second.ecus);
+        vehicle = it->second.vehicle;
+
+        return true;
+    }
+
+    bool discovery_cache::store(const vehicle_info &vehicle, const std::unordered_map<uint32_t, ecu> &ecus) const {
+        // The VIN is used as a field of the file, so it must not contain whitespace
+        bool valid_vin = !vehicle.vin.empty() && std::none_of(vehicle.vin.begin(), vehicle.vin.end(), [](char c) {
+            return std::isspace(static_cast<unsigned char>(c));
+        });
+
+        if (!is_enabled() || !valid_vin || ecus.empty()) {
+            return false;
+        }
+
+        // Entries of other vehicles are kept
+        std::unordered_map<std::string, entry> entries = read_entries();
+        entries[vehicle.vin] = { vehicle, ecus };
+
+        return write_entries(entries);
+    }
+
+    std::unordered_map<std::string, discovery_cache::entry> discovery_cache::read_entries() const {
+        std::unordered_map<std::string, entry> entries;
+        std::ifstream file(path);
+        std::string line;
+
+        entry *current_entry = nullptr;
+        ecu *current_ecu = nullptr;
+
+        // Every line starts with its type, ECUs belong to the vehicle and pids to the ECU above them
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string type;
+
+            fields >> type;
+
+            if (type == "vehicle") {
+                std::string vin;
+                int ign_type;
+
+                current_entry = nullptr;
+                current_ecu = nullptr;
+
+                if (!(fields >> vin >> ign_type)) {
+                    continue;
+                }
+
+                current_entry = &entries[vin];
+                current_entry->vehicle = { .vin = vin, .ign_type = vehicle_info::ignition_type(ign_type) };
+                current_entry->ecus.clear();
+            }
+            else if (type == "ecu" && current_entry) {
+                uint32_t id;
+                std::string name;
+
+                current_ecu = nullptr;
+
+                if (!(fields >> std::hex >> id)) {
+                    continue;
+                }
+
+                // The name is the rest of the line and may be empty
+                std::getline(fields >> std::ws, name);
+                current_ecu = &(current_entry->ecus[id] = ecu(id, name));
+            }
+            else if (type == "pids" && current_ecu) {
+                unsigned int service;
+                unsigned int pid;
+                std::vector<uint8_t> pids;
+
+                if (!(fields >> std::hex >> service)) {
+                    continue;
+                }
+
+                while (fields >> pid) {
+                    pids.push_back(static_cast<uint8_t>(pid));
+                }
+
+                current_ecu->add_supported_pids(static_cast<uint8_t>(service), pids);
+            }
+        }
+
+        return entries;
+    }
+
+    bool discovery_cache::write_entries(const std::unordered_map<std::string, entry> &entries) const {
+        std::string tmp_path = path + ".tmp";
+
+        {
+            std::ofstream file(tmp_path, std::ios::trunc);
+
+            if (!file) {
+                return false;
+            }
+
+            file << std::hex;
+
+            for (auto &[vin, e] : entries) {
+                file << "vehicle " << vin << " " << static_cast<int>(e.vehicle.ign_type) << "\n";
+
+                for (auto &[id, ecu] : e.ecus) {
+                    std::string name = ecu.get_name();
+                    std::replace(name.begin(), name.end(), '\n', ' ');
+
+                    file << "ecu " << id << " " << name << "\n";
+
+                    for (auto &[service, pids] : ecu.supported_pids) {
+                        file << "pids " << static_cast<unsigned int>(service);
+
+                        for (uint8_t pid : pids) {
+                            file << " " << static_cast<unsigned int>(pid);
+                        }
+
+                        file << "\n";
+                    }
+                }
+            }
+
+            if (!file.flush()) {
+                return false;
+            }
+        }
+
+        // Replacing the file at once makes sure readers never see a partially written cache
+        return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+}
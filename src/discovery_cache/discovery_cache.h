@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "../ecu/ecu.h"
+#include "../vehicle_info/vehicle_info.h"
+
+namespace obd2 {
+    // Stores the discovered ECUs and vehicle info of every vehicle in a text file, keyed by VIN.
+    // Without a path the cache is disabled.
+    class discovery_cache {
+        public:
+            discovery_cache();
+            discovery_cache(const std::string &path);
+
+            bool is_enabled() const;
+            const std::string &get_path() const;
+
+            bool load(const std::string &vin, std::unordered_map<uint32_t, ecu> &ecus, vehicle_info &vehicle) const;
+            bool store(const vehicle_info &vehicle, const std::unordered_map<uint32_t, ecu> &ecus) const;
+
+        private:
+            struct entry {
+                vehicle_info vehicle;
+                std::unordered_map<uint32_t, ecu> ecus; // ECU ID => ECU
+            };
+
+            std::string path;
+
+            std::unordered_map<std::string, entry> read_entries() const;
+            bool write_entries(const std::unordered_map<std::string, entry> &entries) const;
+    };
+}
@@ -1,8 +1,5 @@
 #include "dtc.h"
 
-#include <iomanip>
-#include <sstream>
-
 namespace obd2 {
     dtc::dtc() : cat(category(0xFF)), code(0), stat(status(0xFF)) {}
 
@@ -50,31 +47,31 @@ namespace obd2 {
     }
 
     std::string dtc::str() const {
-        std::stringstream ss;
+        static constexpr char hex_digits[] = "0123456789ABCDEF";
+        std::string str(5, 'X');
 
         switch (cat) {
             case dtc::category::POWERTRAIN:
-                ss << "P";
+                str[0] = 'P';
                 break;
             case dtc::category::CHASSIS:
-                ss << "C";
+                str[0] = 'C';
                 break;
             case dtc::category::BODY:
-                ss << "B";
+                str[0] = 'B';
                 break;
             case dtc::category::NETWORK:
-                ss << "U";
+                str[0] = 'U';
                 break;
             default:
-                ss << "X";
                 break;
         }
 
-        // Print nibbles of the code
+        // Print nibbles of the code, the string is short enough to not require an allocation
         for (int i = 0; i < 4; i++) {
-            ss << std::hex << std::uppercase << ((code >> (12 - i * 4)) & 0xF);
+            str[i + 1] = hex_digits[(code >> (12 - i * 4)) & 0xF];
         }
 
-        return ss.str();
+        return str;
     }
 }
@@ -21,5 +21,7 @@ namespace obd2 {
             uint32_t id;
             std::string name;
             std::unordered_map<uint8_t, std::vector<uint8_t>> supported_pids; // Service => PIDs
+
+            friend class discovery_cache;
     };
 }
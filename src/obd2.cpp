@@ -8,28 +8,75 @@ namespace obd2 {
     obd2::obd2() {}
 
     obd2::obd2(const char *if_name, uint32_t refresh_ms, bool enable_pid_chaining) 
-        : protocol_instance(if_name, refresh_ms), enable_pid_chaining(enable_pid_chaining) { }
+        : protocol_instance(if_name, refresh_ms), enable_pid_chaining(enable_pid_chaining) { 
+        setup_broadcast_group();
+        start_heartbeat();
+    }
+
+    obd2::obd2(std::unique_ptr<transport> transport_instance, uint32_t refresh_ms, bool enable_pid_chaining) 
+        : protocol_instance(std::move(transport_instance), refresh_ms), enable_pid_chaining(enable_pid_chaining) { 
+        setup_broadcast_group();
+        start_heartbeat();
+    }
 
     obd2::obd2(obd2 &&o) {
+        bool running = o.heartbeat_running;
+        bool dispatching = o.dispatcher_running;
+
+        // The heartbeat of the moved from instance must not touch the connection anymore
+        o.stop_heartbeat();
+        o.stop_dispatcher();
+
         protocol_instance = std::move(o.protocol_instance);
         req_combinations = std::move(o.req_combinations);
         req_combinations_map = std::move(o.req_combinations_map);
+        request_keys = std::move(o.request_keys);
+        combination_entries = std::move(o.combination_entries);
+        pid_combinations = std::move(o.pid_combinations);
+        chained_combinations = std::move(o.chained_combinations);
+        open_combinations = std::move(o.open_combinations);
         ecus = std::move(o.ecus);
         vehicle = o.vehicle;
+        discovery = o.discovery;
         enable_pid_chaining = o.enable_pid_chaining;
 
         for (auto &p : req_combinations_map) {
             p.first->parent = this;
         }
 
-        o.connection_mutex.lock();
-        last_connection_active = o.last_connection_active.load();
-        o.connection_mutex.unlock();
+        // The response callbacks of the combinations still refer to the moved from instance
+        subscriptions = std::move(o.subscriptions);
+        next_subscription_id = o.next_subscription_id;
+        histories = std::move(o.histories);
+
+        for (std::shared_ptr<req_combination> &c : req_combinations) {
+            install_response_cb(*c);
+        }
+
+        connection = o.connection.load();
+
+        if (running) {
+            start_heartbeat();
+        }
+
+        if (dispatching) {
+            start_dispatcher();
+        }
     }
 
     obd2::~obd2() {
+        stop_heartbeat();
+        stop_dispatcher();
+
+        // The listener may still run after the combinations are gone
+        for (std::shared_ptr<req_combination> &c : req_combinations) {
+            c->get_command().set_response_cb(nullptr);
+        }
+
+        // Requests outliving the instance must not keep the combinations and their commands alive
         for (auto &p : req_combinations_map) {
             p.first->parent = nullptr;
+            p.first->combination.store(nullptr);
         }
     }
 
@@ -38,24 +85,58 @@ namespace obd2 {
             return *this;
         }
 
+        bool running = o.heartbeat_running;
+        bool dispatching = o.dispatcher_running;
+
+        stop_heartbeat();
+        o.stop_heartbeat();
+        stop_dispatcher();
+        o.stop_dispatcher();
+
+        // Requests outliving the instance must not keep the combinations and their commands alive
         for (auto &p : req_combinations_map) {
             p.first->parent = nullptr;
+            p.first->combination.store(nullptr);
+        }
+
+        for (std::shared_ptr<req_combination> &c : req_combinations) {
+            c->get_command().set_response_cb(nullptr);
         }
 
         protocol_instance = std::move(o.protocol_instance);
         req_combinations = std::move(o.req_combinations);
         req_combinations_map = std::move(o.req_combinations_map);
+        request_keys = std::move(o.request_keys);
+        combination_entries = std::move(o.combination_entries);
+        pid_combinations = std::move(o.pid_combinations);
+        chained_combinations = std::move(o.chained_combinations);
+        open_combinations = std::move(o.open_combinations);
         ecus = std::move(o.ecus);
         vehicle = o.vehicle;
+        discovery = o.discovery;
         enable_pid_chaining = o.enable_pid_chaining;
 
         for (auto &p : req_combinations_map) {
             p.first->parent = this;
         }
 
-        o.connection_mutex.lock();
-        last_connection_active = o.last_connection_active.load();
-        o.connection_mutex.unlock();
+        subscriptions = std::move(o.subscriptions);
+        next_subscription_id = o.next_subscription_id;
+        histories = std::move(o.histories);
+
+        for (std::shared_ptr<req_combination> &c : req_combinations) {
+            install_response_cb(*c);
+        }
+
+        connection = o.connection.load();
+
+        if (running) {
+            start_heartbeat();
+        }
+
+        if (dispatching) {
+            start_dispatcher();
+        }
 
         return *this;
     }
@@ -66,25 +147,82 @@ namespace obd2 {
 
     void obd2::set_refresh_ms(uint32_t refresh_ms) {
         protocol_instance.set_refresh_ms(refresh_ms);
+
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        // Combinations mixing requests with and without their own rate depend on the refresh rate
+        for (std::shared_ptr<req_combination> &c : req_combinations) {
+            c->update_refresh_ms(refresh_ms);
+        }
     }
 
     void obd2::set_enable_pid_chaining(bool enable_pid_chaining) {
         this->enable_pid_chaining = enable_pid_chaining;
     }
 
+    void obd2::set_response_timeout(uint32_t floor_ms, uint32_t ceiling_ms) {
+        protocol_instance.set_response_timeout(floor_ms, ceiling_ms);
+    }
+
+    void obd2::set_discovery_cache(const std::string &path) {
+        std::lock_guard<std::mutex> connection_lock(connection_mutex);
+        discovery = discovery_cache(path);
+    }
+
     uint32_t obd2::get_refresh_ms() const {
         return protocol_instance.get_refresh_ms();
     }
 
+    double obd2::get_transactions_per_cycle() {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+        double refresh_ms = protocol_instance.get_refresh_ms();
+        double transactions = 0;
+
+        for (std::shared_ptr<req_combination> &c : req_combinations) {
+            command &cmd = c->get_command();
+
+            if (!cmd.get_refresh()) {
+                continue;
+            }
+
+            uint32_t ms = cmd.get_refresh_ms();
+            transactions += ms == 0 ? 1.0 : refresh_ms / ms;
+        }
+
+        return transactions;
+    }
+
+    rtt_estimator obd2::get_ecu_rtt(uint32_t ecu_id) {
+        return protocol_instance.get_rtt(ecu_id, ecu_id + ECU_ID_RES_OFFSET);
+    }
+
     std::vector<dtc> obd2::get_dtcs(uint32_t ecu_id) {
-        std::vector<dtc> dtcs;
+        return get_dtcs(std::vector<uint32_t>({ ecu_id }))[ecu_id];
+    }
+
+    std::unordered_map<uint32_t, std::vector<dtc>> obd2::get_dtcs(const std::vector<uint32_t> &ecu_ids) {
+        std::unordered_map<uint32_t, std::vector<dtc>> dtcs;
+        std::vector<command> commands;
         dtc::status statuses[] = { dtc::STORED, dtc::PENDING, dtc::PERMANENT };
 
-        // TODO: Multiple requests at the same time
-        for (dtc::status s : statuses) {
-            command c(ecu_id, ecu_id + ECU_ID_RES_OFFSET, s, protocol_instance);
+        commands.reserve(ecu_ids.size() * std::size(statuses));
+
+        // Send the requests of all ECUs and statuses at once, so the waits below overlap
+        for (uint32_t ecu_id : ecu_ids) {
+            dtcs[ecu_id];
 
-            if (c.wait_for_response() != cmd_status::OK) {
+            for (dtc::status s : statuses) {
+                commands.emplace_back(ecu_id, ecu_id + ECU_ID_RES_OFFSET, s, protocol_instance);
+            }
+        }
+
+        // The requests are answered in parallel, so they share one deadline instead of timing out one after another
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DTC_TIMEOUT_MS);
+
+        for (command &c : commands) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+            if (c.wait_for_response(static_cast<uint32_t>(std::max<int64_t>(left.count(), 0))) != cmd_status::OK) {
                 continue;
             }
 
@@ -94,19 +232,42 @@ namespace obd2 {
                 continue;
             }
 
-            std::vector<dtc> response_dtcs = decode_dtcs(response, s);
-            dtcs.insert(dtcs.end(), response_dtcs.begin(), response_dtcs.end());
+            std::vector<dtc> response_dtcs = decode_dtcs(response, static_cast<dtc::status>(c.get_sid()));
+            std::vector<dtc> &ecu_dtcs = dtcs[c.get_tx_id()];
+            ecu_dtcs.insert(ecu_dtcs.end(), response_dtcs.begin(), response_dtcs.end());
         }
 
         return dtcs;
     }
 
+    std::unordered_map<uint32_t, std::vector<dtc>> obd2::get_all_dtcs() {
+        std::vector<uint32_t> ecu_ids;
+
+        {
+            std::lock_guard<std::mutex> connection_lock(connection_mutex);
+
+            for (auto &p : ecus) {
+                ecu_ids.push_back(p.first);
+            }
+        }
+
+        // Without a discovery, every standard ECU is asked
+        if (ecu_ids.empty()) {
+            for (uint32_t ecu_id = ECU_ID_FIRST; ecu_id <= ECU_ID_LAST; ecu_id++) {
+                ecu_ids.push_back(ecu_id);
+            }
+        }
+
+        return get_dtcs(ecu_ids);
+    }
+
     void obd2::clear_dtcs(uint32_t ecu_id) {
         command c(ecu_id, ecu_id + ECU_ID_RES_OFFSET, 0x04, protocol_instance);
     }
 
     std::vector<dtc> obd2::decode_dtcs(const std::vector<uint8_t> &data, dtc::status status) {
         std::vector<dtc> dtcs;
+        dtcs.reserve(data.size() / 2);
 
         for (size_t i = 0; (i + 1) < data.size(); i += 2) {
             uint16_t raw_code = data[i] | data[i + 1] << 8;
@@ -1,76 +1,178 @@
 #include "../include/obd2.h"
 
 #include <algorithm>
+#include <bit>
 #include <future>
 
 namespace obd2 {
-    bool obd2::is_connection_active() {
-        // Try to lock mutex, if not possible, another thread already tries to get the connection status
-        if (!connection_mutex.try_lock()) {
-            uint8_t request_id = connection_request_id;
-
-            // Wait until the other thread has finished
-            while (connection_request_id == request_id) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            }
-
-            return last_connection_active.load();
-        }
-        
-        bool connection_active = query_connection_status();
+    bool obd2::is_connection_active() const {
+        return connection == CONNECTED;
+    }
 
-        if (!connection_active) {
-            // Delete all ecus and vehicle info
-            ecus.clear();
-            vehicle = vehicle_info();
-        }
-        else if (connection_active && ecus.size() == 0) {
-            // Connection was just established, query ecus and vehicle info
-            query_standard_ecus();
-            query_vehicle_info();
-        }
+    obd2::connection_state obd2::get_connection_state() const {
+        return connection;
+    }
 
-        // Notify possible waiting threads that connection status has been updated
-        last_connection_active = connection_active;
-        connection_request_id++;
-        connection_mutex.unlock();
+    bool obd2::wait_for_connection_state(connection_state state, uint32_t timeout_ms) {
+        std::unique_lock<std::mutex> heartbeat_lock(heartbeat_mutex);
 
-        return connection_active;
+        return heartbeat_cv.wait_for(heartbeat_lock, std::chrono::milliseconds(timeout_ms), [this, state] { 
+            return connection == state; 
+        });
     }
 
-    const vehicle_info &obd2::get_vehicle_info() {
-        is_connection_active();
-        
+    vehicle_info obd2::get_vehicle_info() {
+        // The heartbeat replaces the vehicle info on every connection change, so it is copied
+        std::lock_guard<std::mutex> connection_lock(connection_mutex);
         return vehicle;
     }
     
-    std::vector<std::reference_wrapper<ecu>> obd2::get_ecus() {
-        is_connection_active();
-
-        std::vector<std::reference_wrapper<ecu>> ecu_list;
+    std::vector<ecu> obd2::get_ecus() {
+        // The heartbeat clears and rediscovers the ECUs on every connection change, so they are copied
+        std::lock_guard<std::mutex> connection_lock(connection_mutex);
+        std::vector<ecu> ecu_list;
         ecu_list.reserve(ecus.size());
 
         for (auto &pair : ecus) {
-            ecu_list.emplace_back(pair.second);
+            ecu_list.push_back(pair.second);
         }
 
         return ecu_list;
     }
 
-    void obd2::query_standard_ecus() {
+    void obd2::start_heartbeat() {
+        if (heartbeat_running) {
+            return;
+        }
+
+        heartbeat_running = true;
+        heartbeat_thread = std::thread(&obd2::heartbeat, this);
+    }
+
+    void obd2::stop_heartbeat() {
+        if (!heartbeat_running) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> heartbeat_lock(heartbeat_mutex);
+            heartbeat_running = false;
+        }
+
+        heartbeat_cv.notify_all();
+        heartbeat_thread.join();
+    }
+
+    void obd2::heartbeat() {
+        while (heartbeat_running) {
+            bool connection_active = query_connection_status();
+
+            if (!connection_active && connection != DISCONNECTED) {
+                // Delete all ecus and vehicle info
+                {
+                    std::lock_guard<std::mutex> connection_lock(connection_mutex);
+                    ecus.clear();
+                    vehicle = vehicle_info();
+                }
+
+                set_connection_state(DISCONNECTED);
+            }
+            else if (connection_active && connection == DISCONNECTED) {
+                // Connection was just established, query ecus and vehicle info
+                set_connection_state(DISCOVERING);
+                discover();
+                set_connection_state(CONNECTED);
+            }
+
+            std::unique_lock<std::mutex> heartbeat_lock(heartbeat_mutex);
+            heartbeat_cv.wait_for(heartbeat_lock, std::chrono::milliseconds(HEARTBEAT_INTERVAL_MS), [this] { 
+                return !heartbeat_running; 
+            });
+        }
+    }
+
+    void obd2::discover() {
+        discovery_cache cache;
+
+        {
+            std::lock_guard<std::mutex> connection_lock(connection_mutex);
+            cache = discovery;
+        }
+
+        // Known vehicles are restored from the cache, which only costs reading the VIN
+        if (load_discovery(cache)) {
+            return;
+        }
+
+        std::unordered_map<uint32_t, ecu> found_ecus = query_standard_ecus();
+
+        {
+            std::lock_guard<std::mutex> connection_lock(connection_mutex);
+            ecus = found_ecus;
+        }
+
+        // The vehicle info is queried from the cached ECUs, so it comes second
+        vehicle_info found_vehicle = query_vehicle_info();
+
+        {
+            std::lock_guard<std::mutex> connection_lock(connection_mutex);
+            vehicle = found_vehicle;
+        }
+
+        // Writing the file does not hold up readers of the ECUs. Without a VIN the vehicle could not be found again.
+        if (found_vehicle.vin != VIN_UNKNOWN) {
+            cache.store(found_vehicle, found_ecus);
+        }
+    }
+
+    bool obd2::load_discovery(discovery_cache &cache) {
+        std::unordered_map<uint32_t, ecu> found_ecus;
+        vehicle_info found_vehicle;
+
+        if (!cache.is_enabled()) {
+            return false;
+        }
+
+        // Any ECU may answer the probe, a vehicle that is not in the cache falls back to the full discovery
+        std::string vin = query_info_string(ECU_ID_BROADCAST, 0x02, HEARTBEAT_PROBE_TIMEOUT_MS);
+
+        if (vin.empty() || !cache.load(vin, found_ecus, found_vehicle)) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> connection_lock(connection_mutex);
+        ecus = std::move(found_ecus);
+        vehicle = found_vehicle;
+
+        return true;
+    }
+
+    void obd2::set_connection_state(connection_state state) {
+        {
+            std::lock_guard<std::mutex> heartbeat_lock(heartbeat_mutex);
+            connection = state;
+        }
+
+        heartbeat_cv.notify_all();
+    }
+
+    std::unordered_map<uint32_t, ecu> obd2::query_standard_ecus() {
+        std::unordered_map<uint32_t, ecu> found_ecus;
         std::vector<std::future<ecu>> ecu_futures;
 
-        ecu_futures.reserve(ECU_ID_LAST - ECU_ID_FIRST + 1);
+        // Only ECUs that answered the broadcast are queried, so absent ECUs do not have to time out
+        std::vector<uint32_t> ecu_ids = query_responding_ecus();
+        ecu_futures.reserve(ecu_ids.size());
 
         // Asynchronously get information about each ECU
-        for (uint32_t ecu_id = ECU_ID_FIRST; ecu_id <= ECU_ID_LAST; ecu_id++) {
+        for (uint32_t ecu_id : ecu_ids) {
             ecu_futures.emplace_back(
                 std::async(
                     std::launch::async, 
                     &obd2::query_ecu, 
                     this, 
                     ecu_id,
-                    0x09
+                    0x01
                 )
             );
         }
@@ -83,8 +185,10 @@ namespace obd2 {
                 continue;
             }
 
-            ecus[result.get_id()] = result;
+            found_ecus[result.get_id()] = result;
         }
+
+        return found_ecus;
     }
 
     ecu obd2::query_ecu(uint32_t ecu_id, uint8_t query_service) {
@@ -105,12 +209,7 @@ namespace obd2 {
 
         // Try to get ECU name
         if (std::find(pids.begin(), pids.end(), 0x0A) != pids.end()) {
-            command c(ecu_id, ecu_id + ECU_ID_RES_OFFSET, 0x09, 0x0A, protocol_instance);
-
-            if (c.wait_for_response() == cmd_status::OK) {
-                const std::vector<uint8_t> &res = c.get_buffer();
-                ecu_name.assign(reinterpret_cast<const char *>(res.data() + 1));
-            }
+            ecu_name = query_info_string(ecu_id, 0x0A);
         }
 
         result = ecu(ecu_id, ecu_name);
@@ -132,29 +231,46 @@ namespace obd2 {
         return result;
     }
 
-    void obd2::query_vehicle_info() {
-        vehicle = { .vin = "Unkonwn", .ign_type = vehicle_info::UNKNOWN };
+    vehicle_info obd2::query_vehicle_info() {
+        vehicle_info info = { .vin = VIN_UNKNOWN, .ign_type = vehicle_info::UNKNOWN };
         std::vector<uint8_t> pids = get_supported_pids(ECU_ID_FIRST, 0x09);
 
         // Try to get vin
         if (std::find(pids.begin(), pids.end(), 0x02) != pids.end()) {
-            command c(ECU_ID_FIRST, ECU_ID_FIRST + ECU_ID_RES_OFFSET, 0x09, 0x02, protocol_instance);
+            std::string vin = query_info_string(ECU_ID_FIRST, 0x02);
 
-            if (c.wait_for_response() == cmd_status::OK) {
-                std::vector<uint8_t> res = c.get_buffer();
-                res.push_back(0);
-                
-                vehicle.vin = std::string(reinterpret_cast<const char *>(res.data() + 1));
+            if (!vin.empty()) {
+                info.vin = vin;
             }
         }
 
         // Try to get ignition type
         if (std::find(pids.begin(), pids.end(), 0x08) != pids.end()) {
-            vehicle.ign_type = vehicle_info::SPARK;
+            info.ign_type = vehicle_info::SPARK;
         } 
         else if (std::find(pids.begin(), pids.end(), 0x0B) != pids.end()) {
-            vehicle.ign_type = vehicle_info::COMPRESSION;
+            info.ign_type = vehicle_info::COMPRESSION;
+        }
+
+        return info;
+    }
+
+    std::string obd2::query_info_string(uint32_t ecu_id, uint8_t pid, uint32_t timeout_ms) {
+        command c(ecu_id, ecu_id + ECU_ID_RES_OFFSET, 0x09, pid, protocol_instance);
+
+        if (c.wait_for_response(timeout_ms) != cmd_status::OK) {
+            return std::string();
         }
+
+        std::vector<uint8_t> res = c.get_buffer();
+        res.push_back(0);
+
+        // The response starts with the pid and the number of data items
+        if (res.size() < 3) {
+            return std::string();
+        }
+
+        return std::string(reinterpret_cast<const char *>(res.data() + 2));
     }
 
     std::vector<uint8_t> obd2::get_supported_pids(uint32_t ecu_id, uint8_t service) {
@@ -173,9 +289,38 @@ namespace obd2 {
             return true;    
         }
         
-        // Check if main ecu is responding
-        command c(ECU_ID_FIRST, ECU_ID_FIRST + ECU_ID_RES_OFFSET, 0x01, 0x00, protocol_instance);
-        return c.wait_for_response() == cmd_status::OK;
+        // Check if any ecu is responding
+        command c(ECU_ID_BROADCAST, ECU_ID_BROADCAST + ECU_ID_RES_OFFSET, 0x01, 0x00, protocol_instance);
+        return c.wait_for_response(HEARTBEAT_PROBE_TIMEOUT_MS) == cmd_status::OK;
+    }
+
+    std::vector<uint32_t> obd2::query_responding_ecus() {
+        std::vector<uint32_t> ecu_ids;
+
+        // Service 0x01 PID 0x00 has to be supported by every emissions related ECU
+        command c(ECU_ID_BROADCAST, ECU_ID_BROADCAST + ECU_ID_RES_OFFSET, 0x01, 0x00, protocol_instance);
+
+        if (c.wait_for_response() != cmd_status::OK) {
+            return ecu_ids;
+        }
+
+        c.wait_for_responses(ECU_ID_LAST - ECU_ID_FIRST + 1, BROADCAST_SETTLE_MS);
+
+        for (uint32_t rx_id : c.get_responders()) {
+            ecu_ids.push_back(rx_id - ECU_ID_RES_OFFSET);
+        }
+
+        return ecu_ids;
+    }
+
+    void obd2::setup_broadcast_group() {
+        std::vector<protocol::ecu_address> group;
+
+        for (uint32_t ecu_id = ECU_ID_FIRST; ecu_id <= ECU_ID_LAST; ecu_id++) {
+            group.push_back({ ecu_id, ecu_id + ECU_ID_RES_OFFSET });
+        }
+
+        protocol_instance.set_broadcast_group(ECU_ID_BROADCAST, group);
     }
 
     std::vector<uint8_t> obd2::get_supported_pids(uint32_t ecu_id, uint8_t service, bool cache) {
@@ -188,10 +333,12 @@ namespace obd2 {
 
         // Check if requested pids are already cached
         if (cache) {
+            std::unique_lock<std::mutex> connection_lock(connection_mutex);
             auto it = ecus.find(ecu_id);
 
             // If not even the ecu is cached, query it first
             if (it == ecus.end()) {
+                connection_lock.unlock();
                 ecu e = query_ecu(ecu_id, service);
 
                 // If ECU has no connection return empty pids
@@ -199,9 +346,8 @@ namespace obd2 {
                     return pids;
                 }
 
-                ecus[ecu_id] = e;
-
-                it = ecus.find(ecu_id);
+                connection_lock.lock();
+                it = ecus.try_emplace(ecu_id, e).first;
             }
 
             pids = it->second.get_supported_pids(service);
@@ -211,8 +357,16 @@ namespace obd2 {
             }
         }
 
-        // If no pids are cached, query them
-        for (uint8_t pid_range = 0; ; pid_range++) {            
+        // If no pids are cached, query them. Freeze frame requests carry a frame number with each pid,
+        // so only the other services can query several ranges at once.
+        cmd_status status = cmd_status::ERROR;
+
+        if (service != 0x02) {
+            status = query_supported_pids(ecu_id, service, pids);
+        }
+
+        // ECUs that reject chained requests are queried range by range
+        for (uint8_t pid_range = 0; status == cmd_status::ERROR; pid_range++) {            
             std::vector<uint8_t> pids_in_range = get_supported_pids(ecu_id, service, uint8_t(pid_range * PID_SUPPORT_RANGE));
             pids.insert(pids.end(), pids_in_range.begin(), pids_in_range.end());
         
@@ -227,6 +381,7 @@ namespace obd2 {
         }
 
         if (cache) {
+            std::lock_guard<std::mutex> connection_lock(connection_mutex);
             ecus[ecu_id].add_supported_pids(service, pids);
         }
         
@@ -235,26 +390,83 @@ namespace obd2 {
     
     std::vector<uint8_t> obd2::get_supported_pids(uint32_t ecu_id, uint8_t service, uint8_t pid_offset) {
         command c(ecu_id, ecu_id + ECU_ID_RES_OFFSET, service, pid_offset, protocol_instance);
+        pid_bitmaps bitmaps = {};
 
         if (c.wait_for_response() != cmd_status::OK) {
             return std::vector<uint8_t>();
         }
 
-        const std::vector<uint8_t> &response = c.get_buffer();
-        std::vector<uint8_t> data(response.begin() + 1, response.end());
-        return decode_pids_supported(data, pid_offset);
+        read_pid_bitmaps(c.get_view().get_span(), bitmaps);
+        return decode_pids_supported(bitmaps);
     }
 
-    std::vector<uint8_t> obd2::decode_pids_supported(const std::vector<uint8_t> &data, uint8_t pid_offset) {
+    cmd_status obd2::query_supported_pids(uint32_t ecu_id, uint8_t service, std::vector<uint8_t> &pids) {
+        // A request may contain up to six pids, ECUs only answer for the ranges they support
+        static const std::vector<uint16_t> first_ranges = { 0x00, 0x20, 0x40, 0x60, 0x80, 0xA0 };
+        static const std::vector<uint16_t> last_ranges = { 0xC0, 0xE0 };
+        pid_bitmaps bitmaps = {};
+
+        command c(ecu_id, ecu_id + ECU_ID_RES_OFFSET, service, first_ranges, protocol_instance);
+        cmd_status status = c.wait_for_response();
+
+        if (status != cmd_status::OK) {
+            return status;
+        }
+
+        read_pid_bitmaps(c.get_view().get_span(), bitmaps);
+
+        // The last bit of a range tells whether the pids of the next range are supported
+        if (bitmaps[first_ranges.size() - 1] & 1) {
+            command next(ecu_id, ecu_id + ECU_ID_RES_OFFSET, service, last_ranges, protocol_instance);
+
+            if (next.wait_for_response() == cmd_status::OK) {
+                read_pid_bitmaps(next.get_view().get_span(), bitmaps);
+            }
+        }
+
+        pids = decode_pids_supported(bitmaps);
+        return cmd_status::OK;
+    }
+
+    void obd2::read_pid_bitmaps(std::span<const uint8_t> data, pid_bitmaps &bitmaps) {
+        // Responses consist of the range pid followed by four bytes of bitmap for each range
+        for (size_t i = 0; i + 5 <= data.size(); i += 5) {
+            if (data[i] % PID_SUPPORT_RANGE != 0) {
+                break;
+            }
+
+            bitmaps[data[i] / PID_SUPPORT_RANGE] = (static_cast<uint32_t>(data[i + 1]) << 24) 
+                | (static_cast<uint32_t>(data[i + 2]) << 16) 
+                | (static_cast<uint32_t>(data[i + 3]) << 8) 
+                | data[i + 4];
+        }
+    }
+
+    std::vector<uint8_t> obd2::decode_pids_supported(const pid_bitmaps &bitmaps) {
         std::vector<uint8_t> pids;
+        size_t count = 0;
+
+        for (uint32_t bitmap : bitmaps) {
+            count += std::popcount(bitmap);
+        }
 
-        for (uint8_t byte : data) {
-            for (int8_t bit = 7; bit >= 0; bit--) {
-                pid_offset++;
+        pids.reserve(count);
 
-                if (byte & (1 << bit)) {
-                    pids.push_back(pid_offset);
+        // The most significant bit stands for the first pid after the range pid, only set bits are visited
+        for (size_t range = 0; range < bitmaps.size(); range++) {
+            uint32_t bits = bitmaps[range];
+
+            while (bits != 0) {
+                int bit = std::countl_zero(bits);
+                size_t pid = range * PID_SUPPORT_RANGE + bit + 1;
+
+                // The last bit of the last range would be pid 0x100
+                if (pid > 0xFF) {
+                    break;
                 }
+
+                pids.push_back(static_cast<uint8_t>(pid));
+                bits &= ~(0x80000000u >> bit);
             }
         }
 
@@ -1,84 +1,459 @@
 #include "../include/obd2.h"
 
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
 namespace obd2 {
+    size_t obd2::request_key_hash::operator()(const request_key &k) const {
+        return std::hash<std::string>()(k.formula) ^ std::hash<uint64_t>()(combination_key(k.ecu_id, k.service, k.pid));
+    }
+
+    uint64_t obd2::combination_key(uint32_t ecu_id, uint8_t service, uint16_t pid) {
+        return (static_cast<uint64_t>(ecu_id) << 24) | (static_cast<uint64_t>(service) << 16) | pid;
+    }
+
     void obd2::add_request(request &r) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+        request_key key = { r.ecu_id, r.service, r.pid, r.formula_str };
+
         // Check if request already exists
-        for (auto &p : req_combinations_map) {
-            request *existing_r = p.first;
-            
-            if (existing_r->ecu_id == r.ecu_id 
-                && existing_r->service == r.service 
-                && existing_r->pid == r.pid 
-                && existing_r->formula_str == r.formula_str) {
-                throw std::invalid_argument("A request with the specified parameters already exists");
-            }
+        if (request_keys.contains(key)) {
+            throw std::invalid_argument("A request with the specified parameters already exists");
         }
 
-        req_combination &c = get_combination(r.ecu_id, r.service, r.pid, r.refresh && !r.formula_str.empty() && enable_pid_chaining);
+        bool allow_pid_chain = r.refresh && !r.formula_str.empty() && enable_pid_chaining;
+        size_t combination_count = req_combinations.size();
+
+        req_combination &c = get_combination(r.ecu_id, r.service, r.pid, allow_pid_chain);
+        bool was_refreshing = c.get_command().get_refresh();
+        uint32_t old_refresh_ms = c.get_command().get_refresh_ms();
+        double old_transaction_cost = transaction_cost(c.get_response_size());
+
         c.add_request(r);
+        c.update_refresh_ms(protocol_instance.get_refresh_ms());
+        update_open(c);
+
+        // The combination may have been stopped by the requests already in it
+        if (r.refresh) {
+            c.request_resumed();
+        }
 
         req_combinations_map.emplace(&r, c);
+        r.combination = *combination_entries.at(&c);
+        request_keys.insert(std::move(key));
+        pid_combinations[combination_key(r.ecu_id, r.service, r.pid)] = &c;
+
+        // The listener locates the pids of the other requests with the sizes it copied
+        install_response_cb(c);
+
+        // Joining a combination without sending it more often or in more frames costs nothing, so that needs no repack
+        bool costs_more = req_combinations.size() != combination_count 
+            || (r.refresh && !was_refreshing) 
+            || c.get_command().get_refresh_ms() < old_refresh_ms
+            || transaction_cost(c.get_response_size()) > old_transaction_cost;
+
+        if (c.get_allow_pid_chain() && costs_more) {
+            repack_combinations(r.ecu_id, r.service);
+        }
     }
 
     void obd2::remove_request(request &r) {
-        stop_request(r);
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        // Stopped without stop_request, so the chains are only repacked once the request is gone
+        r.refresh = false;
 
         req_combination &c = req_combinations_map.at(&r);
         req_combinations_map.erase(&r);
+        r.combination.store(nullptr);
+        request_keys.erase({ r.ecu_id, r.service, r.pid, r.formula_str });
+
+        bool chained = c.get_allow_pid_chain();
+        bool empty = c.remove_request(r);
+        histories.erase(&r);
+        subscriptions.erase(&r);
 
-        if (c.remove_request(r)) {
-            req_combinations.remove(c);
+        // The pid is only removed from the command once its last request is gone
+        if (empty || !c.contains_pid(r.pid)) {
+            pid_combinations.erase(combination_key(r.ecu_id, r.service, r.pid));
+        }
+
+        if (empty) {
+            erase_combination(c);
+        }
+        else {
+            c.update_refresh_ms(protocol_instance.get_refresh_ms());
+            c.request_stopped();
+            update_open(c);
+            update_subscribed(c);
+            install_response_cb(c);
+        }
+
+        // Removing pids leaves room in the chains, which may now fit into fewer commands
+        if (chained) {
+            repack_combinations(r.ecu_id, r.service);
         }
 
         r.parent = nullptr;
     }
 
     void obd2::move_request(request &old_ref, request &new_ref) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
         req_combination &c = req_combinations_map.at(&old_ref);
         c.move_request(old_ref, new_ref);
 
         req_combinations_map.erase(&old_ref);
         req_combinations_map.emplace(&new_ref, c);
+        new_ref.combination = old_ref.combination.exchange(nullptr);
+
+        // Subscriptions and the history move with the request
+        auto subs = subscriptions.find(&old_ref);
+
+        if (subs != subscriptions.end()) {
+            subscriptions[&new_ref] = std::move(subs->second);
+            subscriptions.erase(&old_ref);
+        }
+
+        auto history = histories.find(&old_ref);
+
+        if (history != histories.end()) {
+            histories[&new_ref] = std::move(history->second);
+            histories.erase(&old_ref);
+        }
     }
 
     req_combination &obd2::get_combination(uint32_t ecu_id, uint8_t service, uint16_t pid, bool allow_pid_chain) {
         // First, check if any command already contains the requested pid
-        for (auto &p : req_combinations_map) {
-            command &c = p.second.get().get_command();
+        auto existing = pid_combinations.find(combination_key(ecu_id, service, pid));
+
+        if (existing != pid_combinations.end()) {
+            return *existing->second;
+        }
+
+        allow_pid_chain = allow_pid_chain && (service == 0x01 || service == 0x02);
+
+        // If not, take the oldest command with room for the pid, the chains are repacked afterwards anyway
+        if (allow_pid_chain) {
+            auto open = open_combinations.find(combination_key(ecu_id, service));
+
+            if (open != open_combinations.end() && !open->second.empty()) {
+                return *open->second.front();
+            }
+        }
+
+        return create_combination(ecu_id, service, pid, allow_pid_chain);
+    }
+
+    req_combination &obd2::create_combination(uint32_t ecu_id, uint8_t service, uint16_t pid, bool allow_pid_chain) {
+        req_combinations.push_back(std::make_shared<req_combination>(ecu_id, service, pid, protocol_instance, true, allow_pid_chain));
+        req_combination &c = *req_combinations.back();
+        combination_entries.emplace(&c, std::prev(req_combinations.end()));
+        install_response_cb(c);
+
+        if (allow_pid_chain) {
+            chained_combinations[combination_key(ecu_id, service)].push_back(&c);
+            update_open(c);
+        }
 
-            if (c.get_tx_id() == ecu_id && c.get_sid() == service && c.contains_pid(pid)) {
-                return p.second;
+        return c;
+    }
+
+    void obd2::erase_combination(req_combination &c) {
+        // Waits for the listener to leave the callback, which refers to the combination
+        c.get_command().set_response_cb(nullptr);
+
+        uint64_t key = combination_key(c.get_command().get_tx_id(), c.get_command().get_sid());
+
+        for (auto *index : { &chained_combinations, &open_combinations }) {
+            auto combinations = index->find(key);
+
+            if (combinations != index->end()) {
+                std::erase(combinations->second, &c);
             }
-        }       
+        }
+
+        auto entry = combination_entries.find(&c);
+        req_combinations.erase(entry->second);
+        combination_entries.erase(entry);
+    }
+
+    void obd2::update_open(req_combination &c) {
+        if (!c.get_allow_pid_chain()) {
+            return;
+        }
+
+        std::vector<req_combination *> &open = open_combinations[combination_key(c.get_command().get_tx_id(), c.get_command().get_sid())];
+        auto it = std::find(open.begin(), open.end(), &c);
+        bool has_room = c.get_pid_count() < MAX_CHAINED_PIDS;
+
+        if (has_room && it == open.end()) {
+            open.push_back(&c);
+        }
+        else if (!has_room && it != open.end()) {
+            open.erase(it);
+        }
+    }
+
+    void obd2::repack_combinations(uint32_t ecu_id, uint8_t service) {
+        // All requests of a pid share a combination, so pids are packed as a whole
+        struct chain_item {
+            uint16_t pid = 0;
+            size_t size = 0;
+            uint32_t period_ms = UINT32_MAX; // Pids of stopped requests need no rate and only fill up chains
+            req_combination *current = nullptr;
+        };
+
+        struct chain_bin {
+            size_t size = 1; // Response sid
+            std::vector<chain_item *> items;
+            req_combination *target = nullptr;
+        };
+
+        auto chained = chained_combinations.find(combination_key(ecu_id, service));
+
+        if (chained == chained_combinations.end()) {
+            return;
+        }
+
+        uint32_t default_ms = protocol_instance.get_refresh_ms();
+        std::unordered_map<uint16_t, chain_item> items;
+        std::vector<chain_item *> order;
+
+        items.reserve(chained->second.size() * MAX_CHAINED_PIDS);
+        order.reserve(chained->second.size() * MAX_CHAINED_PIDS);
+
+        for (req_combination *c : chained->second) {
+            for (request &r : c->get_requests()) {
+                auto [it, added] = items.try_emplace(r.get_pid());
+                chain_item &item = it->second;
+
+                if (added) {
+                    item.pid = r.get_pid();
+                    item.current = c;
+                    order.push_back(&item);
+                }
+
+                item.size = std::max(item.size, r.get_expected_size());
+
+                if (r.get_refresh()) {
+                    item.period_ms = std::min(item.period_ms, r.get_refresh_ms() != 0 ? r.get_refresh_ms() : default_ms);
+                }
+            }
+        }
+
+        // Transactions per refresh cycle of a command sent at the given period, weighted by the frames of its response
+        auto cycle_cost = [default_ms](uint32_t period_ms, size_t response_size) {
+            return period_ms == UINT32_MAX ? 0.0 : static_cast<double>(default_ms) / period_ms * transaction_cost(response_size);
+        };
+
+        // Combinations are visited in the order they were created, so the same requests are always packed the same way
+        std::unordered_map<req_combination *, size_t> current_index;
+        std::vector<chain_bin> current_bins;
+        double current_cost = 0.0;
+
+        for (chain_item *item : order) {
+            auto [it, added] = current_index.try_emplace(item->current, current_bins.size());
+
+            if (added) {
+                current_bins.emplace_back();
+            }
+
+            chain_bin &bin = current_bins[it->second];
+            bin.size += 1 + item->size;
+            bin.items.push_back(item);
+        }
+
+        for (chain_bin &bin : current_bins) {
+            uint32_t period_ms = (*std::min_element(bin.items.begin(), bin.items.end(), [](const chain_item *a, const chain_item *b) {
+                return a->period_ms < b->period_ms;
+            }))->period_ms;
+
+            current_cost += cycle_cost(period_ms, bin.size);
+        }
+
+        // Faster pids are packed first, so slower pids only share a command with them if there is room left,
+        // which costs no additional transactions. Larger pids first leave the small ones to fill the gaps.
+        // The sort is stable, so pids sharing a combination stay next to each other and tend to stay together.
+        std::stable_sort(order.begin(), order.end(), [](const chain_item *a, const chain_item *b) {
+            return std::tie(a->period_ms, b->size) < std::tie(b->period_ms, a->size);
+        });
 
-        // If not, check if there is any command to which the pid request can be added to
-        if (allow_pid_chain && (service == 0x01 || service == 0x02)) {
-            for (auto &p : req_combinations_map) {
-                req_combination &c = p.second.get();
-                command &cmd = c.get_command();
+        std::vector<chain_bin> bins;
+        size_t first_open = 0;
 
-                if (cmd.get_tx_id() != ecu_id || cmd.get_sid() != service) {
+        for (chain_item *item : order) {
+            // Full bins are skipped for good
+            while (first_open < bins.size() && bins[first_open].items.size() >= MAX_CHAINED_PIDS) {
+                first_open++;
+            }
+
+            // Each pid joins the bin it adds the least cost to. Items are sorted by period, so the first one of a bin
+            // is its fastest. A pid only gets a command of its own if the frames it adds elsewhere cost more.
+            size_t best = bins.size();
+            double best_cost = cycle_cost(item->period_ms, 2 + item->size);
+
+            for (size_t i = first_open; i < bins.size(); i++) {
+                chain_bin &b = bins[i];
+
+                if (b.items.size() >= MAX_CHAINED_PIDS) {
                     continue;
                 }
-                
-                if (!c.get_allow_pid_chain()) {
+
+                uint32_t period_ms = b.items.front()->period_ms;
+                double cost = cycle_cost(period_ms, b.size + 1 + item->size) - cycle_cost(period_ms, b.size);
+
+                if (best == bins.size() ? cost <= best_cost : cost < best_cost) {
+                    best = i;
+                    best_cost = cost;
+                }
+            }
+
+            if (best == bins.size()) {
+                bins.emplace_back();
+            }
+
+            bins[best].size += 1 + item->size;
+            bins[best].items.push_back(item);
+        }
+
+        double packed_cost = 0.0;
+
+        for (chain_bin &bin : bins) {
+            packed_cost += cycle_cost(bin.items.front()->period_ms, bin.size);
+        }
+
+        // Moving pids resets their values until the next response, so only repack if it saves transactions or commands
+        bool saves_transactions = packed_cost < current_cost - REPACK_MIN_SAVING;
+        bool saves_commands = packed_cost < current_cost + REPACK_MIN_SAVING && bins.size() < chained->second.size();
+
+        if (!saves_transactions && !saves_commands) {
+            return;
+        }
+
+        // Every bin keeps the combination most of its pids are in already, so as few pids as possible are moved
+        std::unordered_set<req_combination *> taken;
+
+        for (chain_bin &bin : bins) {
+            size_t best_count = 0;
+
+            for (chain_item *item : bin.items) {
+                if (taken.contains(item->current)) {
                     continue;
                 }
 
-                if (c.get_pid_count() >= 6 && !c.contains_pid(pid)) {
+                size_t count = std::count_if(bin.items.begin(), bin.items.end(), [item](const chain_item *i) {
+                    return i->current == item->current;
+                });
+
+                if (count > best_count) {
+                    best_count = count;
+                    bin.target = item->current;
+                }
+            }
+
+            if (bin.target) {
+                taken.insert(bin.target);
+            }
+        }
+
+        std::vector<req_combination *> touched;
+
+        auto touch = [&touched](req_combination *c) {
+            if (std::find(touched.begin(), touched.end(), c) == touched.end()) {
+                touched.push_back(c);
+            }
+        };
+
+        for (chain_bin &bin : bins) {
+            for (chain_item *item : bin.items) {
+                if (item->current == bin.target) {
                     continue;
                 }
 
-                return c;
+                // Bins without a combination get a new one with their first pid
+                bin.target = &move_pid(item->pid, *item->current, bin.target);
+                touch(item->current);
+                touch(bin.target);
             }
         }
 
-        return req_combinations.emplace_back(
-            ecu_id, service, pid, protocol_instance, true, allow_pid_chain && (service == 0x01 || service == 0x02)
-        );
+        for (req_combination *c : touched) {
+            if (c->get_requests().empty()) {
+                erase_combination(*c);
+                continue;
+            }
+
+            c->update_refresh_ms(default_ms);
+
+            // Moved requests may have to run in a combination that was stopped, or may have left it with none
+            bool refresh = std::any_of(c->get_requests().begin(), c->get_requests().end(), [](const request &r) {
+                return r.get_refresh();
+            });
+
+            if (refresh) {
+                c->request_resumed();
+            }
+            else {
+                c->request_stopped();
+            }
+        }
+    }
+
+    double obd2::transaction_cost(size_t response_size) {
+        if (response_size <= ISOTP_SINGLE_FRAME_SIZE) {
+            return 1.0;
+        }
+
+        size_t consecutive_frames = (response_size - ISOTP_FIRST_FRAME_SIZE + ISOTP_CONSECUTIVE_FRAME_SIZE - 1) / ISOTP_CONSECUTIVE_FRAME_SIZE;
+
+        // The flow control frame is sent between the first and the consecutive frames
+        return 1.0 + CHAINED_FRAME_COST * (1 + consecutive_frames);
+    }
+
+    req_combination &obd2::move_pid(uint16_t pid, req_combination &from, req_combination *to) {
+        std::vector<std::reference_wrapper<request>> moved;
+
+        for (request &r : from.get_requests()) {
+            if (r.get_pid() == pid) {
+                moved.push_back(r);
+            }
+        }
+
+        for (request &r : moved) {
+            from.remove_request(r);
+        }
+
+        // The pid is removed first, as a new command with the same pids as another one would share its backend
+        if (!to) {
+            to = &create_combination(from.get_command().get_tx_id(), from.get_command().get_sid(), pid, true);
+        }
+
+        for (request &r : moved) {
+            to->add_request(r);
+            req_combinations_map.at(&r) = *to;
+            r.combination = *combination_entries.at(to);
+        }
+
+        pid_combinations[combination_key(to->get_command().get_tx_id(), to->get_command().get_sid(), pid)] = to;
+        update_open(from);
+        update_open(*to);
+        update_subscribed(from);
+        update_subscribed(*to);
+
+        // The pids of both commands changed, and the listener keeps writing the histories of the moved requests
+        install_response_cb(from);
+        install_response_cb(*to);
+
+        return *to;
     }
 
     void obd2::resume_request(request &r) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
         if (r.refresh) {
             return;
         }
@@ -86,10 +461,34 @@ namespace obd2 {
         r.refresh = true;
 
         req_combination &c = req_combinations_map.at(&r);
+        c.update_refresh_ms(protocol_instance.get_refresh_ms());
         c.request_resumed();
+
+        if (c.get_allow_pid_chain()) {
+            repack_combinations(r.ecu_id, r.service);
+        }
+    }
+
+    void obd2::update_refresh_ms(request &r) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        req_combination &c = req_combinations_map.at(&r);
+        c.update_refresh_ms(protocol_instance.get_refresh_ms());
+
+        // A new rate may group the pid with others
+        if (c.get_allow_pid_chain()) {
+            repack_combinations(r.ecu_id, r.service);
+        }
+    }
+
+    uint64_t obd2::get_deadline_misses(request &r) {
+        std::shared_ptr<req_combination> c = r.combination.load();
+        return c ? c->get_command().get_deadline_misses() : 0;
     }
 
     void obd2::stop_request(request &r) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
         if (!r.refresh) {
             return;
         }
@@ -97,43 +496,64 @@ namespace obd2 {
         r.refresh = false;
 
         req_combination &c = req_combinations_map.at(&r);
+        c.update_refresh_ms(protocol_instance.get_refresh_ms());
         c.request_stopped();
+
+        if (c.get_allow_pid_chain()) {
+            repack_combinations(r.ecu_id, r.service);
+        }
     }
 
-    std::vector<uint8_t> obd2::get_data(request &r) {
-        req_combination &c = req_combinations_map.at(&r);
-        const std::vector<uint8_t> &data = c.get_command().get_buffer();
-        std::vector<uint8_t> decoded_data;
+    response_view obd2::get_data(request &r, uint32_t ecu_id) {
+        // Repacking may move the request to another combination or erase its combination at any time. Without
+        // taking the requests mutex, the reference keeps the combination read here alive until the view is taken.
+        std::shared_ptr<req_combination> combination = r.combination.load();
+
+        if (!combination) {
+            return response_view();
+        }
+
+        req_combination &c = *combination;
+
+        // Broadcast requests hold the response of every ECU, without an ECU ID the first one that responded is used
+        response_view data = ecu_id == 0 
+            ? c.get_command().get_view() 
+            : c.get_command().get_view(ecu_id + ECU_ID_RES_OFFSET);
 
         if (c.get_command().get_response_status() == cmd_status::ERROR) {
-            return decoded_data;
+            return response_view();
         }
 
-        if (data.size() == 0) {
-            return data;
+        return get_data(r, c, data);
+    }
+
+    response_view obd2::get_data(request &r, req_combination &c, const response_view &data) {
+        if (data.empty()) {
+            return response_view();
         }
 
         // If the request is not part of a chain, return the raw response minus the pid at the front
         if (c.get_pid_count() == 1) {
-            decoded_data = std::vector<uint8_t>(data.begin() + 1, data.end());
-            return decoded_data;
+            return data.subview(1);
         }
 
-        // Else decode the response
-        decoded_data.reserve(r.get_expected_size());
+        // Else look up the data of the pid in the layout of the response
+        return c.get_pid_data(data, r.pid).subview(0, r.get_expected_size());
+    }
 
-        for (size_t i = 0; i < data.size(); ) {
-            if (data[i] != r.pid) {
-                i += c.get_var_count(data[i]) + 1;
-                continue;
-            }
+    std::vector<uint32_t> obd2::get_responding_ecus(request &r) {
+        std::shared_ptr<req_combination> c = r.combination.load();
+
+        if (!c) {
+            return std::vector<uint32_t>();
+        }
 
-            auto data_start = data.begin() + i + 1;
+        std::vector<uint32_t> ecu_ids = c->get_command().get_responders();
 
-            decoded_data = std::vector<uint8_t>(data_start, data_start + r.get_expected_size());
-            break;
+        for (uint32_t &id : ecu_ids) {
+            id -= ECU_ID_RES_OFFSET;
         }
 
-        return decoded_data;
+        return ecu_ids;
     }
 }
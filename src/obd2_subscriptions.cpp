@@ -0,0 +1,257 @@
+#include "../include/obd2.h"
+
+#include <algorithm>
+
+namespace obd2 {
+    uint64_t obd2::get_dropped_notifications() const {
+        return dropped_notifications;
+    }
+
+    uint32_t obd2::subscribe(request &r, const request::subscription_cb &cb) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        uint32_t id = next_subscription_id++;
+        subscriptions[&r].push_back({ id, std::make_shared<const request::subscription_cb>(cb) });
+        update_subscribed(req_combinations_map.at(&r));
+
+        // The dispatcher is only started once it is needed
+        start_dispatcher();
+
+        return id;
+    }
+
+    void obd2::unsubscribe(request &r, uint32_t id) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+        auto subs = subscriptions.find(&r);
+
+        if (subs == subscriptions.end()) {
+            return;
+        }
+
+        std::erase_if(subs->second, [id](const subscription &s) {
+            return s.id == id;
+        });
+
+        if (subs->second.empty()) {
+            subscriptions.erase(subs);
+        }
+
+        update_subscribed(req_combinations_map.at(&r));
+    }
+
+    void obd2::update_subscribed(req_combination &c) {
+        bool subscribed = std::any_of(c.get_requests().begin(), c.get_requests().end(), [this](request &r) {
+            return subscriptions.contains(&r);
+        });
+
+        c.set_subscribed(subscribed);
+    }
+
+    void obd2::install_response_cb(req_combination &c) {
+        // The listener gets its own copy of everything it needs for the histories, so it never touches the requests
+        // or the layout of the combination. It has to be installed again whenever the pids of the combination change.
+        std::vector<history_target> targets;
+        pid_sizes sizes;
+
+        for (request &r : c.get_requests()) {
+            auto history = histories.find(&r);
+
+            if (history != histories.end()) {
+                targets.push_back({ r.pid, r.get_expected_size(), r.formula, history->second });
+            }
+        }
+
+        if (!targets.empty()) {
+            for (uint16_t pid : std::vector<uint16_t>(c.get_command().get_pids())) {
+                sizes.emplace_back(pid, c.get_var_count(pid));
+            }
+        }
+
+        c.get_command().set_response_cb([this, &c, targets = std::move(targets), sizes = std::move(sizes)](uint32_t rx_id, uint64_t generation, std::chrono::steady_clock::time_point recieved_at) {
+            if (!targets.empty()) {
+                record_history(c, targets, sizes, rx_id, recieved_at);
+            }
+
+            queue_response(c, rx_id, generation, recieved_at);
+        });
+    }
+
+    void obd2::set_history_capacity(request &r, size_t capacity) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        if (capacity == 0) {
+            histories.erase(&r);
+        }
+        else {
+            histories[&r] = std::make_shared<sample_history>(capacity);
+        }
+
+        install_response_cb(req_combinations_map.at(&r));
+    }
+
+    std::shared_ptr<const sample_history> obd2::get_history(request &r) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+        auto history = histories.find(&r);
+
+        return history == histories.end() ? nullptr : history->second;
+    }
+
+    void obd2::record_history(req_combination &c, const std::vector<history_target> &targets, const pid_sizes &sizes, uint32_t rx_id, std::chrono::steady_clock::time_point recieved_at) {
+        // Called by the listener right after publishing the response, so the view holds exactly that response
+        response_view data = c.get_command().get_view(rx_id);
+        bool chained = sizes.size() > 1;
+
+        // The pids of the command changed and the callback with their sizes is installed right after
+        if (chained && !find_pid_data(data, sizes, UINT16_MAX).has_value()) {
+            return;
+        }
+
+        for (const history_target &t : targets) {
+            response_view value_data = chained ? find_pid_data(data, sizes, t.pid).value().subview(0, t.size) : data.subview(1);
+            float value = value_data.empty() ? request::NO_RESPONSE : t.formula.solve(value_data.get_span());
+
+            t.history->push({ recieved_at, rx_id - ECU_ID_RES_OFFSET, value });
+        }
+    }
+
+    std::optional<response_view> obd2::find_pid_data(const response_view &data, const pid_sizes &sizes, uint16_t pid) {
+        for (size_t i = 0; i < data.size(); ) {
+            auto size = std::find_if(sizes.begin(), sizes.end(), [&data, i](const std::pair<uint16_t, size_t> &s) {
+                return s.first == data[i];
+            });
+
+            // The pids of the command changed after the sizes were copied, so the response can not be located
+            if (size == sizes.end()) {
+                return std::nullopt;
+            }
+
+            if (data[i] == pid) {
+                return data.subview(i + 1, size->second);
+            }
+
+            i += size->second + 1;
+        }
+
+        return response_view();
+    }
+
+    void obd2::start_dispatcher() {
+        if (dispatcher_running) {
+            return;
+        }
+
+        dispatcher_running = true;
+        dispatcher_thread = std::thread(&obd2::dispatcher, this);
+    }
+
+    void obd2::stop_dispatcher() {
+        if (!dispatcher_running) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> dispatch_lock(dispatch_mutex);
+            dispatcher_running = false;
+            dispatch_head = 0;
+            dispatch_count = 0;
+        }
+
+        dispatch_cv.notify_all();
+        dispatcher_thread.join();
+    }
+
+    void obd2::dispatcher() {
+        while (dispatcher_running) {
+            response_event event;
+
+            {
+                std::unique_lock<std::mutex> dispatch_lock(dispatch_mutex);
+                dispatch_cv.wait(dispatch_lock, [this] { 
+                    return !dispatcher_running || dispatch_count > 0; 
+                });
+
+                if (!dispatcher_running) {
+                    return;
+                }
+
+                event = dispatch_queue[dispatch_head];
+                dispatch_head = (dispatch_head + 1) % SUBSCRIPTION_QUEUE_SIZE;
+                dispatch_count--;
+            }
+
+            dispatch_response(event);
+        }
+    }
+
+    void obd2::queue_response(req_combination &c, uint32_t rx_id, uint64_t generation, std::chrono::steady_clock::time_point recieved_at) {
+        // Called by the listener, so it never waits for the dispatcher
+        if (!c.is_subscribed()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> dispatch_lock(dispatch_mutex);
+
+            // Subscribers care most about recent values, so the oldest notification makes room
+            if (dispatch_count == SUBSCRIPTION_QUEUE_SIZE) {
+                dispatch_head = (dispatch_head + 1) % SUBSCRIPTION_QUEUE_SIZE;
+                dispatch_count--;
+                dropped_notifications++;
+            }
+
+            dispatch_queue[(dispatch_head + dispatch_count) % SUBSCRIPTION_QUEUE_SIZE] = { &c, rx_id, generation, recieved_at };
+            dispatch_count++;
+        }
+
+        dispatch_cv.notify_one();
+    }
+
+    void obd2::dispatch_response(const response_event &event) {
+        {
+            std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+            // The combination may have been erased since the response arrived
+            if (!combination_entries.contains(event.combination)) {
+                return;
+            }
+
+            req_combination &c = *event.combination;
+            response_view data = c.get_command().get_view(event.rx_id);
+
+            // A newer response of the ECU replaced this one and has its own notification
+            if (data.empty() || data.get_generation() != event.generation) {
+                return;
+            }
+
+            uint32_t ecu_id = event.rx_id - ECU_ID_RES_OFFSET;
+            size_t first_call = pending_calls.size();
+
+            for (request &r : c.get_requests()) {
+                auto subs = subscriptions.find(&r);
+
+                if (subs == subscriptions.end()) {
+                    continue;
+                }
+
+                response_view value_data = get_data(r, c, data);
+                float value = value_data.empty() ? request::NO_RESPONSE : r.formula.solve(value_data.get_span());
+
+                for (subscription &s : subs->second) {
+                    pending_calls.emplace_back(s.cb, request::sample{ event.recieved_at, ecu_id, value });
+                }
+            }
+
+            // Newer responses overwrote this one while it was solved, they have their own notifications
+            if (!data.is_intact()) {
+                pending_calls.resize(first_call);
+            }
+        }
+
+        // Subscriptions are called without holding the lock, so they may use their requests
+        for (auto &[cb, s] : pending_calls) {
+            (*cb)(s);
+        }
+
+        pending_calls.clear();
+    }
+}
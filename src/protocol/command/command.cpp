@@ -3,6 +3,7 @@
 #include <stdexcept>
 
 #include "command_backend/command_backend.h"
+#include "../protocol.h"
 
 namespace obd2 {
     command::command() : active_backend(nullptr) {}
@@ -15,21 +16,49 @@ namespace obd2 {
 
     command::command(uint32_t tx_id, uint32_t rx_id, uint8_t sid, const std::vector<uint16_t> &pids, 
         protocol &parent, bool refresh) {
-        active_backend = &find_backend(tx_id, rx_id, sid, pids, parent, refresh);
+        active_backend = &parent.acquire_backend(tx_id, rx_id, sid, pids, refresh);
+    }
+
+    command::command(const command &c) : active_backend(c.active_backend) {
+        // The backend can not be released in the meantime, as c still uses it
+        if (active_backend) {
+            active_backend->usage++;
+        }
+    }
+
+    command::command(command &&c) : active_backend(c.active_backend) {
+        c.active_backend = nullptr;
     }
 
     command::~command() {
-        std::unique_lock<std::mutex> commands_lock(get_command_mutex());
+        release();
+    }
 
-        auto &command_usage = get_command_usage();
+    command &command::operator=(const command &c) {
+        if (this == &c || active_backend == c.active_backend) {
+            return *this;
+        }
 
-        command_usage[active_backend]--;
+        release();
+        active_backend = c.active_backend;
 
-        if (command_usage[active_backend] == 0) {
-            remove_backend(*active_backend);
+        if (active_backend) {
+            active_backend->usage++;
         }
 
-        active_backend = nullptr;
+        return *this;
+    }
+
+    command &command::operator=(command &&c) {
+        if (this == &c) {
+            return *this;
+        }
+
+        release();
+        active_backend = c.active_backend;
+        c.active_backend = nullptr;
+
+        return *this;
     }
 
     bool command::operator==(const command &c) const {
@@ -52,6 +81,38 @@ namespace obd2 {
         active_backend->stop();
     }
 
+    void command::set_refresh_ms(uint32_t ms) {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
+        }
+
+        active_backend->set_refresh_ms(ms);
+    }
+
+    uint32_t command::get_refresh_ms() const {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
+        }
+
+        return active_backend->get_refresh_ms();
+    }
+
+    uint64_t command::get_deadline_misses() const {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
+        }
+
+        return active_backend->get_deadline_misses();
+    }
+
+    bool command::get_refresh() const {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
+        }
+
+        return active_backend->get_refresh();
+    }
+
     uint32_t command::get_tx_id() const {
         if (!active_backend) {
             throw std::runtime_error("Command not initialized");
@@ -132,65 +193,69 @@ namespace obd2 {
         return active_backend->wait_for_response(timeout_ms, sample_us);
     }
 
-    const std::vector<uint8_t> &command::get_buffer() {
+    size_t command::wait_for_responses(size_t count, uint32_t timeout_ms) {
         if (!active_backend) {
             throw std::runtime_error("Command not initialized");
         }
 
-        return active_backend->get_buffer();
+        return active_backend->wait_for_responses(count, timeout_ms);
     }
 
-    command_backend &command::find_backend(uint32_t tx_id, uint32_t rx_id, uint8_t sid, const std::vector<uint16_t> &pids, 
-        protocol &parent, bool refresh) {
-        std::unique_lock<std::mutex> commands_lock(get_command_mutex());
+    std::vector<uint8_t> command::get_buffer() {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
+        }
 
-        // Check if identical command already exists
-        for (command_backend &c : get_command_backends()) {
-            if (c.tx_id != tx_id || c.rx_id != rx_id || c.sid != sid || c.parent != &parent) {
-                continue;
-            }
-            
-            if (c.get_pids() != pids) {
-                continue;
-            }
+        return active_backend->get_buffer();
+    }
 
-            return c;
+    response_view command::get_view() {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
         }
 
-        command_backend &c = get_command_backends().emplace_back(tx_id, rx_id, sid, pids, parent, refresh);
-        get_command_usage().emplace(&c, 1);
-        
-        return c;
+        return active_backend->get_view();
     }
 
-    void command::remove_backend(command_backend &c) {
-        get_command_usage().erase(&c);
-
-        auto &commands = get_command_backends();
-        
-        for (auto it = commands.begin(); it != commands.end(); it++) {
-            if (&*it == &c) {
-                commands.erase(it);
-                break;
-            }
+    response_view command::get_view(uint32_t rx_id) {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
         }
+
+        return active_backend->get_view(rx_id);
     }
 
-    std::list<command_backend> &command::get_command_backends() {
-        static std::list<command_backend> *commands = new std::list<command_backend>();
+    std::vector<uint32_t> command::get_responders() {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
+        }
 
-        return *commands;
+        return active_backend->get_responders();
     }
 
-    std::unordered_map<command_backend *, std::atomic<uint32_t>> &command::get_command_usage() {
-        static std::unordered_map<command_backend *, std::atomic<uint32_t>> *command_usage = new std::unordered_map<command_backend *, std::atomic<uint32_t>>();
+    void command::set_response_cb(const std::function<void(uint32_t, uint64_t, std::chrono::steady_clock::time_point)> &cb) {
+        if (!active_backend) {
+            throw std::runtime_error("Command not initialized");
+        }
 
-        return *command_usage;
+        active_backend->set_response_cb(cb);
     }
 
-    std::mutex &command::get_command_mutex() {
-        static std::mutex *commands_mutex = new std::mutex();
+    void command::release() {
+        if (!active_backend) {
+            return;
+        }
 
-        return *commands_mutex;
+        protocol *owner = active_backend->owner;
+
+        if (owner) {
+            owner->release_backend(*active_backend);
+        }
+        else if (--active_backend->usage == 0) {
+            // The protocol is gone, so the last command cleans up the backend
+            delete active_backend;
+        }
+
+        active_backend = nullptr;
     }
 }
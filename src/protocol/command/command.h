@@ -1,13 +1,12 @@
 #pragma once
 
-#include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <list>
-#include <mutex>
+#include <functional>
 #include <vector>
-#include <unordered_map>
 
 #include "command_backend/cmd_status.h"
+#include "response_view/response_view.h"
 
 namespace obd2 {
     class command_backend;
@@ -19,12 +18,21 @@ namespace obd2 {
             command(uint32_t tx_id, uint32_t rx_id, uint8_t sid, protocol &parent, bool refresh = false);
             command(uint32_t tx_id, uint32_t rx_id, uint8_t sid, uint16_t pid, protocol &parent, bool refresh = false);
             command(uint32_t tx_id, uint32_t rx_id, uint8_t sid, const std::vector<uint16_t> &pids, protocol &parent, bool refresh = false);
+            command(const command &c);
+            command(command &&c);
             ~command();
 
+            command &operator=(const command &c);
+            command &operator=(command &&c);
+
             bool operator==(const command &c) const;
 
             void resume();
             void stop();
+            void set_refresh_ms(uint32_t ms);
+            uint32_t get_refresh_ms() const;
+            uint64_t get_deadline_misses() const;
+            bool get_refresh() const;
             uint32_t get_tx_id() const;
             uint32_t get_rx_id() const;
             uint8_t get_sid() const;
@@ -35,20 +43,16 @@ namespace obd2 {
             bool contains_pid(uint16_t pid);
             cmd_status get_response_status();
             cmd_status wait_for_response(uint32_t timeout_ms = 5000, uint32_t sample_us = 1000);
-            const std::vector<uint8_t> &get_buffer();
+            size_t wait_for_responses(size_t count, uint32_t timeout_ms = 5000);
+            std::vector<uint8_t> get_buffer();
+            response_view get_view();
+            response_view get_view(uint32_t rx_id);
+            std::vector<uint32_t> get_responders();
+            void set_response_cb(const std::function<void(uint32_t, uint64_t, std::chrono::steady_clock::time_point)> &cb);
 
         private:
             command_backend *active_backend;
 
-            command_backend &find_backend(uint32_t tx_id, uint32_t rx_id, uint8_t sid, const std::vector<uint16_t> &pids,
-                protocol &parent, bool refresh);
-            void remove_backend(command_backend &c);
-
-            // The following three resources could have been beautiful statics, but because of CPPs unpredicatbly static destruction order, 
-            // they are not. This is a workaround to avoid memory leaks. Without this workaround the statics would be destroyed before the 
-            // command instances, which would cause undefined behaviours.
-            std::list<command_backend> &get_command_backends();
-            std::unordered_map<command_backend *, std::atomic<uint32_t>> &get_command_usage();
-            std::mutex &get_command_mutex();
+            void release();
     };
 }
@@ -15,27 +15,50 @@ namespace obd2 {
         : command_backend(tx_id, rx_id, sid, std::vector<uint16_t>({ pid }), parent, refresh) {}
 
     command_backend::command_backend(uint32_t tx_id, uint32_t rx_id, uint8_t sid, const std::vector<uint16_t> &pids, protocol &parent, bool refresh) 
-        : parent(&parent), tx_id(tx_id), rx_id(rx_id), sid(sid), pids(pids), refresh(refresh) { 
+        : parent(&parent), slot_pool(parent.slot_pool), tx_id(tx_id), rx_id(rx_id), sid(sid), pids(pids), refresh(refresh) { 
+        std::vector<uint32_t> receivers = parent.get_broadcast_receivers(tx_id);
+        broadcast = !receivers.empty();
+
+        if (!broadcast) {
+            receivers.push_back(rx_id);
+        }
+
+        channels = std::vector<response_channel>(receivers.size());
+
+        for (size_t i = 0; i < receivers.size(); i++) {
+            channels[i].rx_id = receivers[i];
+            channels[i].slots = slot_pool->acquire();
+        }
+
+        // Sent by the registry once it released its lock, so a blocking transport does not hold up other commands
         parent.add_command(*this);
-        parent.process_command(*this);
     }
 
-    command_backend::command_backend(command_backend &&c) : parent(c.parent), tx_id(c.tx_id), rx_id(c.rx_id), sid(c.sid) {
+    command_backend::command_backend(command_backend &&c) 
+        : parent(c.parent.load()), broadcast(c.broadcast), tx_id(c.tx_id), rx_id(c.rx_id), sid(c.sid), one_shot(c.one_shot) {
         refresh.store(c.refresh);
+        refresh_ms.store(c.refresh_ms);
+        deadline_misses.store(c.deadline_misses);
 
         if (c.parent) {	
-            parent->move_command(c, *this);
+            parent.load()->move_command(c, *this);
         }
 
-        response_buffer = std::move(c.get_buffer());
+        // The slots move with their channels, so views of the moved from command stay intact
+        slot_pool = c.slot_pool;
+        channels = std::move(c.channels);
+        response_generation = c.response_generation;
         response_status.store(c.response_status);
-        response_updated = false;
 
         pids = std::move(c.get_pids());
+
+        std::lock_guard<std::mutex> response_cb_lock(c.response_cb_mutex);
+        response_cb = std::move(c.response_cb);
     }
 
     command_backend::~command_backend() {
         complete();
+        release_slots();
     }
 
     command_backend &command_backend::operator=(command_backend &&c) {
@@ -43,29 +66,38 @@ namespace obd2 {
             return *this;
         }
 
-        if (parent) {
-            parent->remove_command(*this);
+        if (protocol *p = parent) {
+            p->remove_command(*this);
         }
 
-        parent = c.parent;
+        parent = c.parent.load();
         tx_id = c.tx_id;
         rx_id = c.rx_id;
         sid = c.sid;
+        broadcast = c.broadcast;
+        one_shot = c.one_shot;
         refresh.store(c.refresh);
+        refresh_ms.store(c.refresh_ms);
+        deadline_misses.store(c.deadline_misses);
 
         if (c.parent) {
-            parent->move_command(c, *this);
+            parent.load()->move_command(c, *this);
         }
 
-        std::lock_guard<std::mutex> response_bufs_lock(response_bufs_mutex);
         std::lock_guard<std::mutex> pids_lock(pids_mutex);
 
-        response_buffer = std::move(c.get_buffer());
+        // The slots move with their channels, so views of the moved from command stay intact
+        release_slots();
+        slot_pool = c.slot_pool;
+        channels = std::move(c.channels);
+        response_generation = c.response_generation;
         response_status.store(c.response_status);
-        response_updated = false;
 
         pids = std::move(c.get_pids());
 
+        std::scoped_lock response_cb_lock(response_cb_mutex, c.response_cb_mutex);
+        response_cb = std::move(c.response_cb);
+
         return *this;
     }
 
@@ -79,23 +111,77 @@ namespace obd2 {
         return response_status;
     }
     
-    const std::vector<uint8_t> &command_backend::get_buffer() {
-        // Check if buffers need to be cycled
-        if (response_updated) {
-            std::lock_guard<std::mutex> response_bufs_lock(response_bufs_mutex);
+    std::vector<uint8_t> command_backend::get_buffer() {
+        return get_view().to_vector();
+    }
+
+    response_view command_backend::get_view() {
+        // Broadcast commands return the response of the first ECU of the group that responded
+        for (response_channel &channel : channels) {
+            if (channel.current_slot >= 0) {
+                return get_view(channel);
+            }
+        }
+
+        return response_view();
+    }
+
+    response_view command_backend::get_view(uint32_t rx_id) {
+        response_channel *channel = find_channel(rx_id);
+
+        if (!channel) {
+            return response_view();
+        }
+
+        return get_view(*channel);
+    }
+
+    response_view command_backend::get_view(response_channel &channel) {
+        int index = channel.current_slot;
+
+        if (index < 0) {
+            return response_view();
+        }
+
+        // The listener only overwrites this slot after publishing newer responses to the others. If it did so
+        // since the index was read, the view is empty or holds a newer response, so it is never retried.
+        return response_view((*channel.slots)[index]);
+    }
+
+    std::vector<uint32_t> command_backend::get_responders() {
+        std::vector<uint32_t> responders;
+
+        for (response_channel &channel : channels) {
+            if (channel.current_slot >= 0) {
+                responders.push_back(channel.rx_id);
+            }
+        }
+
+        return responders;
+    }
 
-            response_buffer = std::move(back_buffer);
-            back_buffer = std::vector<uint8_t>();
+    bool command_backend::is_broadcast() const {
+        return broadcast;
+    }
+
+    command_backend::response_channel *command_backend::find_channel(uint32_t rx_id) {
+        // Commands that are not broadcast only have one receiver
+        if (!broadcast) {
+            return channels.empty() ? nullptr : &channels.front();
+        }
 
-            response_updated = false;
+        for (response_channel &channel : channels) {
+            if (channel.rx_id == rx_id) {
+                return &channel;
+            }
         }
 
-        return response_buffer;
+        return nullptr;
     }
 
     void command_backend::complete() {
-        if (parent) {
-            parent->remove_command(*this);
+        if (protocol *p = parent) {
+            p->remove_command(*this);
         }
     }
 
@@ -103,14 +189,38 @@ namespace obd2 {
         check_parent();
 
         refresh = true;
+        parent.load()->resume_command(*this);
     }
 
     void command_backend::stop() {
         check_parent();
 
+        // The command leaves the schedule at its next period, so resuming it before does not send it twice
         refresh = false;
     }
 
+    void command_backend::set_refresh_ms(uint32_t ms) {
+        // Takes effect with the next period of the command
+        refresh_ms = ms;
+    }
+
+    uint32_t command_backend::get_refresh_ms() const {
+        return refresh_ms;
+    }
+
+    uint64_t command_backend::get_deadline_misses() const {
+        return deadline_misses;
+    }
+
+    void command_backend::set_response_cb(const std::function<void(uint32_t, uint64_t, std::chrono::steady_clock::time_point)> &cb) {
+        std::lock_guard<std::mutex> response_cb_lock(response_cb_mutex);
+        response_cb = cb;
+    }
+
+    bool command_backend::get_refresh() const {
+        return refresh;
+    }
+
     uint32_t command_backend::get_tx_id() const {
         return tx_id;
     }
@@ -129,18 +239,64 @@ namespace obd2 {
     }
 
     void command_backend::set_pids(const std::vector<uint16_t> &pids) {
-        std::lock_guard<std::mutex> pids_lock(pids_mutex);
-        this->pids = pids;
+        std::vector<uint16_t> old_pids;
+
+        {
+            std::lock_guard<std::mutex> pids_lock(pids_mutex);
+            old_pids = std::move(this->pids);
+            this->pids = pids;
+        }
+
+        if (owner) {
+            owner.load()->rekey_backend(*this, old_pids);
+        }
+
+        // The parent locks the pids itself, so it is notified after releasing them
+        if (protocol *p = parent) {
+            for (uint16_t pid : old_pids) {
+                p->remove_command_pid(*this, pid);
+            }
+
+            for (uint16_t pid : pids) {
+                p->add_command_pid(*this, pid);
+            }
+        }
     }
 
     void command_backend::add_pid(uint16_t pid) {
-        std::lock_guard<std::mutex> pids_lock(pids_mutex);
-        pids.push_back(pid);
+        std::vector<uint16_t> old_pids;
+
+        {
+            std::lock_guard<std::mutex> pids_lock(pids_mutex);
+            old_pids = pids;
+            pids.push_back(pid);
+        }
+
+        if (owner) {
+            owner.load()->rekey_backend(*this, old_pids);
+        }
+
+        if (protocol *p = parent) {
+            p->add_command_pid(*this, pid);
+        }
     }
 
     void command_backend::remove_pid(uint16_t pid) {
-        std::lock_guard<std::mutex> pids_lock(pids_mutex);
-        pids.erase(std::find(pids.begin(), pids.end(), pid));
+        std::vector<uint16_t> old_pids;
+
+        {
+            std::lock_guard<std::mutex> pids_lock(pids_mutex);
+            old_pids = pids;
+            pids.erase(std::find(pids.begin(), pids.end(), pid));
+        }
+
+        if (owner) {
+            owner.load()->rekey_backend(*this, old_pids);
+        }
+
+        if (protocol *p = parent) {
+            p->remove_command_pid(*this, pid);
+        }
     }
     
     bool command_backend::contains_pid(uint16_t pid) {
@@ -148,19 +304,79 @@ namespace obd2 {
         return std::find(pids.begin(), pids.end(), pid) != pids.end();
     }
 
-    cmd_status command_backend::wait_for_response(uint32_t timeout_ms, uint32_t sample_us) {
-        check_parent();
+    cmd_status command_backend::wait_for_response(uint32_t timeout_ms, uint32_t /* sample_us */) {
+        // The listener sets the status of a one shot command before it completes the command, so the parent is
+        // read first. A command completed by its response then returns that status instead of failing the check.
+        protocol *p = parent;
+
+        std::unique_lock<std::mutex> status_lock(status_mutex);
 
-        auto start = std::chrono::steady_clock::now();
+        if (response_status != WAITING) {
+            return response_status;
+        }
 
-        while (response_status == WAITING 
-            && (std::chrono::steady_clock::now() - start) < std::chrono::milliseconds(timeout_ms)) {
-            std::this_thread::sleep_for(std::chrono::microseconds(sample_us));
+        if (!p) {
+            throw std::runtime_error("Command is completed or has no parent");
         }
 
+        status_cv.wait_for(status_lock, std::chrono::milliseconds(timeout_ms), [this] { 
+            return response_status != WAITING; 
+        });
+
         return response_status;
     }
 
+    size_t command_backend::wait_for_responses(size_t count, uint32_t timeout_ms) {
+        auto responded = [this] {
+            size_t n = 0;
+
+            for (response_channel &channel : channels) {
+                if (channel.current_slot >= 0) {
+                    n++;
+                }
+            }
+
+            return n;
+        };
+
+        // Read before the responses for the same reason as in wait_for_response
+        protocol *p = parent;
+
+        std::unique_lock<std::mutex> status_lock(status_mutex);
+
+        if (responded() >= count) {
+            return responded();
+        }
+
+        if (!p) {
+            throw std::runtime_error("Command is completed or has no parent");
+        }
+
+        status_cv.wait_for(status_lock, std::chrono::milliseconds(timeout_ms), [&] { 
+            return responded() >= count; 
+        });
+
+        return responded();
+    }
+
+    void command_backend::set_response_status(cmd_status status) {
+        // Waiters only wait for the first response, so later status changes do not need to wake anyone
+        if (response_status.exchange(status) != WAITING) {
+            return;
+        }
+
+        notify_waiters();
+    }
+
+    void command_backend::notify_waiters() {
+        // Taking the mutex makes sure a waiter either sees the new status or is already waiting
+        { 
+            std::lock_guard<std::mutex> status_lock(status_mutex); 
+        }
+
+        status_cv.notify_all();
+    }
+
     void command_backend::check_parent() {
         if (!parent) {
             throw std::runtime_error("Command is completed or has no parent");
@@ -184,16 +400,69 @@ namespace obd2 {
         return buf;
     }
 
-    void command_backend::update_back_buffer(const uint8_t *start, const uint8_t *end) {
-        // If the command is not set to be refreshed, do not update the buffer when it has already recieved a response
-        if (!refresh && (response_status == OK || response_status == ERROR)) {
+    void command_backend::update_back_buffer(const uint8_t *start, const uint8_t *end, cmd_status status, uint32_t rx_id) {
+        response_channel *channel = find_channel(rx_id);
+
+        if (!channel) {
             return;
         }
 
-        std::lock_guard<std::mutex> response_bufs_lock(response_bufs_mutex);
+        int current = channel->current_slot;
+
+        // If the command is not set to be refreshed, keep the first response of each receiver
+        bool responded = broadcast ? current >= 0 : (response_status == OK || response_status == ERROR);
+
+        if (!refresh && responded) {
+            return;
+        }
+
+        // The oldest slot is overwritten, views still reading it see its sequence change
+        int index = (current + 1) % static_cast<int>(response_slot_pool::SLOT_COUNT);
+        response_slot &slot = (*channel->slots)[index];
+        uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        size_t size = std::min(static_cast<size_t>(end - start), slot.data.size());
+        uint64_t generation = ++response_generation;
+
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::copy(start, start + size, slot.data.begin());
+        slot.size.store(size, std::memory_order_relaxed);
+        slot.generation.store(generation, std::memory_order_relaxed);
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+
+        channel->current_slot = index;
+        set_response_status(status);
 
-        back_buffer.assign(start, end);
-        response_updated = true;
-        response_status = OK;
+        if (status == OK) {
+            call_response_cb(rx_id, generation);
+        }
+
+        // Waiters for several receivers have to be woken up by every first response
+        if (broadcast && current < 0) {
+            notify_waiters();
+        }
+    }
+
+    void command_backend::call_response_cb(uint32_t rx_id, uint64_t generation) {
+        std::lock_guard<std::mutex> response_cb_lock(response_cb_mutex);
+
+        if (response_cb) {
+            response_cb(rx_id, generation, std::chrono::steady_clock::now());
+        }
+    }
+
+    void command_backend::release_slots() {
+        for (response_channel &channel : channels) {
+            slot_pool->release(std::move(channel.slots));
+        }
+
+        channels.clear();
+    }
+
+    void command_backend::clear_response() {
+        for (response_channel &channel : channels) {
+            channel.current_slot = -1;
+        }
     }
 }
@@ -1,13 +1,20 @@
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <vector>
 #include <list>
+#include <memory>
 #include <mutex>
 
 #include "cmd_status.h"
+#include "../response_view/response_slot_pool.h"
+#include "../response_view/response_view.h"
 
 namespace obd2 {
     class protocol;
@@ -30,6 +37,12 @@ namespace obd2 {
             void complete();
             void resume();
             void stop();
+            // Period of cyclic commands, 0 uses the refresh rate of the parent
+            void set_refresh_ms(uint32_t ms);
+            uint32_t get_refresh_ms() const;
+            // Number of periods in which the command was not answered in time
+            uint64_t get_deadline_misses() const;
+            bool get_refresh() const;
             uint32_t get_tx_id() const;
             uint32_t get_rx_id() const;
             uint8_t get_sid() const;
@@ -39,18 +52,45 @@ namespace obd2 {
             void remove_pid(uint16_t pid);
             bool contains_pid(uint16_t pid);
             cmd_status get_response_status();
+            // Blocks until the first response arrives, sample_us is no longer used and only kept for compatibility
             cmd_status wait_for_response(uint32_t timeout_ms = 5000, uint32_t sample_us = 1000);
-            const std::vector<uint8_t> &get_buffer();
+            // Blocks until count receivers have responded, returns the number of receivers that responded
+            size_t wait_for_responses(size_t count, uint32_t timeout_ms = 5000);
+            std::vector<uint8_t> get_buffer();
+            response_view get_view();
+            response_view get_view(uint32_t rx_id);
+            std::vector<uint32_t> get_responders();
+            bool is_broadcast() const;
+            // Called by the listener with the receiver, generation and time of every positive response.
+            // Must not block, as it holds up the listener. Clearing it waits for a running call to return.
+            void set_response_cb(const std::function<void(uint32_t, uint64_t, std::chrono::steady_clock::time_point)> &cb);
 
         private:
-            protocol *parent;
+            // Cleared by the listener when it completes a one shot command, while its owner may be waiting for it
+            std::atomic<protocol *> parent;
 
-            std::vector<uint8_t> back_buffer;
-            std::vector<uint8_t> response_buffer;
-            std::mutex response_bufs_mutex;
+            // Responses are published to preallocated slots. The listener overwrites the oldest slot and readers
+            // validate the sequence of the current one without locking, so neither side allocates or waits.
+            // Broadcast commands have a channel for each ECU of the broadcast group, other commands only one.
+            struct response_channel {
+                uint32_t rx_id = 0;
+                std::unique_ptr<response_slot_pool::slot_array> slots;
+                std::atomic<int> current_slot = -1;
+            };
+
+            // Pool of the protocol the command was created for, the slots are returned to it on destruction
+            std::shared_ptr<response_slot_pool> slot_pool;
+
+            std::vector<response_channel> channels; // Not resized after construction
+            uint64_t response_generation = 0; // Only written by the listener
+            bool broadcast = false;
+
+            std::function<void(uint32_t, uint64_t, std::chrono::steady_clock::time_point)> response_cb;
+            std::mutex response_cb_mutex;
 
-            std::atomic<bool> response_updated = false;
             std::atomic<cmd_status> response_status = WAITING;
+            std::mutex status_mutex;
+            std::condition_variable status_cv;
 
             uint32_t tx_id;
             uint32_t rx_id;
@@ -61,9 +101,32 @@ namespace obd2 {
 
             std::atomic<bool> refresh;
 
+            // Protocol whose registry owns the backend and number of commands using it.
+            // Without an owner the backend is deleted by its last command.
+            std::atomic<protocol *> owner = nullptr;
+            std::atomic<uint32_t> usage = 0;
+
+            // Time the request was last sent, guarded by the parents commands mutex
+            std::chrono::steady_clock::time_point sent_at;
+
+            // Scheduling state, guarded by the parents commands mutex
+            std::atomic<uint32_t> refresh_ms = 0;
+            std::atomic<uint64_t> deadline_misses = 0;
+            std::chrono::steady_clock::time_point released_at;
+            std::chrono::steady_clock::time_point deadline;
+            bool scheduled = false;
+            bool one_shot = false;
+
             void check_parent();
             std::vector<uint8_t> get_can_msg();
-            void update_back_buffer(const uint8_t *start, const uint8_t *end);
+            void update_back_buffer(const uint8_t *start, const uint8_t *end, cmd_status status = OK, uint32_t rx_id = 0);
+            void clear_response();
+            void set_response_status(cmd_status status);
+            void notify_waiters();
+            void call_response_cb(uint32_t rx_id, uint64_t generation);
+            response_channel *find_channel(uint32_t rx_id);
+            response_view get_view(response_channel &channel);
+            void release_slots();
 
             friend class protocol;
             friend class command;
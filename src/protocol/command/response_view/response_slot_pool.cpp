@@ -0,0 +1,27 @@
+#include "response_slot_pool.h"
+
+namespace obd2 {
+    std::unique_ptr<response_slot_pool::slot_array> response_slot_pool::acquire() {
+        {
+            std::lock_guard<std::mutex> free_lock(free_mutex);
+
+            if (!free.empty()) {
+                std::unique_ptr<slot_array> slots = std::move(free.back());
+                free.pop_back();
+
+                return slots;
+            }
+        }
+
+        return std::make_unique<slot_array>();
+    }
+
+    void response_slot_pool::release(std::unique_ptr<slot_array> slots) {
+        if (!slots) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> free_lock(free_mutex);
+        free.push_back(std::move(slots));
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "response_view.h"
+
+namespace obd2 {
+    // Slot arrays of the commands of one protocol. The protocol and each of its commands share the pool, so it
+    // lives as long as any of them. Arrays of destroyed commands are kept for new commands instead of being freed,
+    // so a view that outlives its command reads a recycled slot, which fails its sequence check.
+    class response_slot_pool {
+        public:
+            static constexpr size_t SLOT_COUNT = 4;
+
+            using slot_array = std::array<response_slot, SLOT_COUNT>;
+
+            std::unique_ptr<slot_array> acquire();
+            void release(std::unique_ptr<slot_array> slots);
+
+        private:
+            std::vector<std::unique_ptr<slot_array>> free;
+            std::mutex free_mutex;
+    };
+}
@@ -0,0 +1,99 @@
+#include "response_view.h"
+
+#include <algorithm>
+
+namespace obd2 {
+    response_view::response_view() { }
+
+    response_view::response_view(const response_slot &slot) {
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+        if (sequence % 2 != 0) {
+            return;
+        }
+
+        uint64_t generation = slot.generation.load(std::memory_order_relaxed);
+        size_t size = slot.size.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // The listener started writing the slot while its size was read
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            return;
+        }
+
+        this->slot = &slot;
+        this->sequence = sequence;
+        this->generation = generation;
+        data_span = std::span<const uint8_t>(slot.data.data(), size);
+    }
+
+    response_view response_view::subview(size_t offset, size_t size) const {
+        // Out of range parts are cut off instead of throwing, as responses of ECUs may be shorter than expected
+        if (offset >= data_span.size()) {
+            return response_view();
+        }
+
+        response_view v(*this);
+        v.data_span = data_span.subspan(offset, std::min(size, data_span.size() - offset));
+
+        return v;
+    }
+
+    const uint8_t *response_view::data() const {
+        return data_span.data();
+    }
+
+    size_t response_view::size() const {
+        return data_span.size();
+    }
+
+    bool response_view::empty() const {
+        return data_span.empty();
+    }
+
+    const uint8_t *response_view::begin() const {
+        return data_span.data();
+    }
+
+    const uint8_t *response_view::end() const {
+        return data_span.data() + data_span.size();
+    }
+
+    uint8_t response_view::operator[](size_t i) const {
+        return data_span[i];
+    }
+
+    std::span<const uint8_t> response_view::get_span() const {
+        if (!is_intact()) {
+            return std::span<const uint8_t>();
+        }
+
+        return data_span;
+    }
+
+    std::vector<uint8_t> response_view::to_vector() const {
+        std::vector<uint8_t> v(begin(), end());
+
+        if (!is_intact()) {
+            v.clear();
+        }
+
+        return v;
+    }
+
+    uint64_t response_view::get_generation() const {
+        return generation;
+    }
+
+    bool response_view::is_intact() const {
+        if (!slot) {
+            return true;
+        }
+
+        // Orders the reads of the data before the check of the sequence
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        return slot->sequence.load(std::memory_order_relaxed) == sequence;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace obd2 {
+    // Preallocated storage of one response. The listener is the only writer of a slot and readers check its
+    // sequence like a seqlock, so neither side waits for the other.
+    struct response_slot {
+        static constexpr size_t CAPACITY = 1024; // Largest message read by the protocol
+
+        // Odd while the listener writes the slot. Slots are recycled with their sequence, so it never repeats.
+        std::atomic<uint64_t> sequence = 0;
+        std::atomic<uint64_t> generation = 0;
+        std::atomic<size_t> size = 0;
+        std::array<uint8_t, CAPACITY> data;
+    };
+
+    // Read only view into a response of a command. Copying a view never copies the data and takes no reference,
+    // so views must not outlive the protocol and all of its commands.
+    // The listener only overwrites the oldest of several slots, so the data of a view stays unchanged until
+    // some newer responses arrived. Readers check is_intact() after reading the data to detect that.
+    class response_view {
+        public:
+            response_view();
+            // Takes the response currently in the slot, empty if the listener is writing it
+            response_view(const response_slot &slot);
+
+            response_view subview(size_t offset, size_t size = SIZE_MAX) const;
+
+            // Unchecked access to the data
+            const uint8_t *data() const;
+            size_t size() const;
+            bool empty() const;
+            const uint8_t *begin() const;
+            const uint8_t *end() const;
+            uint8_t operator[](size_t i) const;
+
+            // Empty if the response was already overwritten. It can still be overwritten while the span is read.
+            std::span<const uint8_t> get_span() const;
+            // Copies the data, empty if the response was overwritten while copying it
+            std::vector<uint8_t> to_vector() const;
+
+            // Number of the response the view belongs to, increases with every response of the command
+            uint64_t get_generation() const;
+            // False if the listener overwrote the slot since the view was taken, so data read from it may be torn
+            bool is_intact() const;
+
+        private:
+            const response_slot *slot = nullptr;
+            std::span<const uint8_t> data_span;
+            uint64_t sequence = 0;
+            uint64_t generation = 0;
+    };
+}
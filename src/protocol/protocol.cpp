@@ -1,15 +1,15 @@
 #include "protocol.h"
 
+#include <algorithm>
 #include <iostream>
 #include <cerrno>
 #include <chrono>
 #include <cstring>
 #include <functional>
-#include <net/if.h>
 #include <stdexcept>
-#include <sys/ioctl.h>
 
 #include "command/command_backend/command_backend.h"
+#include "transport/isotp/isotp_transport.h"
 
 #define UDS_MSG_MAX             1024
 
@@ -26,61 +26,64 @@ namespace obd2 {
     protocol::protocol() {}
 
     protocol::protocol(const char *if_name, uint32_t refresh_ms) 
-        : refresh_ms(refresh_ms) {
-        
-        // Get index of specified CAN interface name
-        if ((if_index = if_nametoindex(if_name)) == 0) {
-            throw std::system_error(std::error_code(errno, std::generic_category()));
+        : protocol(std::make_unique<isotp_transport>(if_name), refresh_ms) { }
+
+    protocol::protocol(std::unique_ptr<transport> transport_instance, uint32_t refresh_ms) 
+        : transport_instance(std::move(transport_instance)), refresh_ms(refresh_ms) {
+        if (!this->transport_instance) {
+            throw std::invalid_argument("Protocol requires a transport");
         }
 
         // Start background command listener thread
-        listener_running = true;
-        listener_thread = std::thread(&protocol::command_listener, this);
+        start_listener();
     }
 
     protocol::protocol(protocol &&p) {
-        listener_running.store(p.listener_running);
-        refresh_ms.store(p.refresh_ms);
-
-        if_index = p.if_index;
-
-        if (listener_running) {
-            listener_thread = std::thread(&protocol::command_listener, this);
-        }
+        bool running = p.listener_running;
 
-        refreshed_cb = p.refreshed_cb;
+        // The listener of the moved from instance must not touch the sockets anymore
+        p.stop_listener();
+        p.close_reactor();
 
-        std::lock_guard<std::mutex> commands_lock(commands_mutex);
-        std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
-        std::lock_guard<std::mutex> refreshed_cb_lock(refreshed_cb_mutex);
+        refresh_ms.store(p.refresh_ms);
 
-        for (auto &p : command_socket_map) {
-            p.first->parent = nullptr;
+        {
+            std::lock_guard<std::mutex> commands_lock(commands_mutex);
+            std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
+            std::lock_guard<std::mutex> refreshed_cb_lock(refreshed_cb_mutex);
+
+            command_socket_map = std::move(p.command_socket_map);
+            dispatch_index = std::move(p.dispatch_index);
+            broadcast_receivers = std::move(p.broadcast_receivers);
+            release_queue = std::move(p.release_queue);
+            ready_queues = std::move(p.ready_queues);
+            socket_states = std::move(p.socket_states);
+            transport_instance = std::move(p.transport_instance);
+            sockets = std::move(p.sockets);
+            refreshed_cb = std::move(p.refreshed_cb);
+
+            for (auto &p : command_socket_map) {
+                p.first->parent = this;
+            }
         }
 
-        command_socket_map = std::move(p.command_socket_map);
-        sockets = std::move(p.sockets);
-        refreshed_cb = std::move(p.refreshed_cb);
+        move_backends(p);
 
-        for (auto &p : command_socket_map) {
-            p.first->parent = this;
+        if (running) {
+            start_listener();
         }
     }
 
     protocol::~protocol() {
-        listener_running = false;
-
-        // Try to join listener thread if it is running
-        try {
-            listener_thread.join();
-        }
-        catch(const std::system_error &e) {
-            // Ignore error if thread is not joinable
-        }
+        stop_listener();
+        close_reactor();
 
         for (auto &p : command_socket_map) {
             p.first->parent = nullptr;
         }
+
+        std::lock_guard<std::mutex> backends_lock(backends_mutex);
+        orphan_backends();
     }
 
     protocol &protocol::operator=(protocol &&p) {
@@ -88,142 +91,333 @@ namespace obd2 {
             return *this;
         }
 
-        if (listener_running) {
-            listener_running = false;
-            listener_thread.join();
-        }
+        bool running = p.listener_running;
+
+        stop_listener();
+        close_reactor();
+        p.stop_listener();
+        p.close_reactor();
 
         refresh_ms.store(p.refresh_ms);
-        listener_running.store(p.listener_running);
-        
-        if_index = p.if_index;
 
-        if (listener_running) {
-            listener_thread = std::thread(&protocol::command_listener, this);
-        }
+        {
+            std::lock_guard<std::mutex> commands_lock(commands_mutex);
+            std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
+            std::lock_guard<std::mutex> refreshed_cb_lock(refreshed_cb_mutex);
 
-        std::lock_guard<std::mutex> commands_lock(commands_mutex);
-        std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
-        std::lock_guard<std::mutex> refreshed_cb_lock(refreshed_cb_mutex);
+            for (auto &p : command_socket_map) {
+                p.first->parent = nullptr;
+            }
 
-        for (auto &p : command_socket_map) {
-            p.first->parent = nullptr;
+            command_socket_map = std::move(p.command_socket_map);
+            dispatch_index = std::move(p.dispatch_index);
+            broadcast_receivers = std::move(p.broadcast_receivers);
+            release_queue = std::move(p.release_queue);
+            ready_queues = std::move(p.ready_queues);
+            socket_states = std::move(p.socket_states);
+            transport_instance = std::move(p.transport_instance);
+            sockets = std::move(p.sockets);
+            refreshed_cb = std::move(p.refreshed_cb);
+
+            for (auto &p : command_socket_map) {
+                p.first->parent = this;
+            }
         }
 
-        command_socket_map = std::move(p.command_socket_map);
-        sockets = std::move(p.sockets);
-        refreshed_cb = std::move(p.refreshed_cb);
+        move_backends(p);
 
-        for (auto &p : command_socket_map) {
-            p.first->parent = this;
+        if (running) {
+            start_listener();
         }
 
         return *this;
     }
 
+    void protocol::start_listener() {
+        setup_reactor();
+
+        std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
+
+        for (auto &s : sockets) {
+            watch_socket(*s);
+        }
+
+        listener_running = true;
+        listener_thread = std::thread(&protocol::command_listener, this);
+    }
+
+    void protocol::stop_listener() {
+        listener_running = false;
+        wake_listener();
+
+        if (listener_thread.joinable()) {
+            listener_thread.join();
+        }
+    }
+
     void protocol::command_listener() {
-        while (listener_running) {
-            auto delay = std::chrono::milliseconds(refresh_ms);
-            auto start = std::chrono::steady_clock::now();
+        auto cycle_start = std::chrono::steady_clock::now();
 
-            // Reset flag for this iteration
-            next_recieved_response = false;
+        while (listener_running) {
+            auto now = std::chrono::steady_clock::now();
+            auto cycle_end = cycle_start + std::chrono::milliseconds(refresh_ms);
 
-            process_commands();
+            // The response flag and the refreshed callback follow the refresh rate of the protocol,
+            // while every command is sent at its own rate
+            if (now >= cycle_end) {
+                // Update flag with every response recieved since the last refresh
+                recieved_response = next_recieved_response.exchange(false);
 
-            // Process sockets once again, in case the command queue was empty but there are still responses to be received
-            process_sockets();
+                call_refreshed_cb();
 
-            // Update flag after processing sockets
-            recieved_response = next_recieved_response.load();
+                cycle_start = now;
+                cycle_end = now + std::chrono::milliseconds(refresh_ms);
+            }
 
-            call_refreshed_cb();
+            auto next_event = std::min(cycle_end, process_commands(now));
 
-            std::this_thread::sleep_until(start + delay);
+            // Handle incoming responses as soon as they arrive, any event may make another command due
+            arm_tick(next_event);
+            wait_events(-1);
         }
     }
 
-    socket_wrapper &protocol::get_socket(uint32_t tx_id, uint32_t rx_id) {
+    socket_wrapper &protocol::get_socket(uint32_t tx_id, uint32_t rx_id, bool broadcast) {
         std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
 
         // Check if socket already exists
-        for (socket_wrapper &s : sockets) {
-            if (s.tx_id == tx_id && s.rx_id == rx_id) {
-                return s;
+        for (auto &s : sockets) {
+            if (s->tx_id == tx_id && s->rx_id == rx_id) {
+                return *s;
             }
         }
 
-        return sockets.emplace_back(tx_id, rx_id, if_index);
+        if (!transport_instance) {
+            throw std::runtime_error("Protocol has no transport");
+        }
+
+        // Broadcast sockets only send, so they are told apart from the receiving sockets by an rx id of 0
+        socket_wrapper &s = *sockets.emplace_back(broadcast 
+            ? transport_instance->open_broadcast(tx_id) 
+            : transport_instance->open(tx_id, rx_id));
+        watch_socket(s);
+
+        return s;
     }
 
-    void protocol::process_commands() {
-        std::queue<std::reference_wrapper<command_backend>> new_command_queue;
-        
-        while (!command_queue.empty()) {
-            command_backend &c = command_queue.front();
-            command_queue.pop();
+    std::vector<socket_wrapper *> protocol::get_dispatch_sockets(command_backend &c, socket_wrapper &s) {
+        if (!c.broadcast) {
+            return { &s };
+        }
+
+        // Responses to broadcast commands arrive on the sockets of the ECUs of the group
+        auto receivers = broadcast_receivers.find(c.tx_id);
+
+        if (receivers == broadcast_receivers.end()) {
+            return {};
+        }
+
+        return receivers->second;
+    }
+
+    std::vector<uint32_t> protocol::get_broadcast_receivers(uint32_t tx_id) {
+        std::lock_guard<std::mutex> commands_lock(commands_mutex);
+        std::vector<uint32_t> rx_ids;
+        auto receivers = broadcast_receivers.find(tx_id);
+
+        if (receivers != broadcast_receivers.end()) {
+            for (socket_wrapper *s : receivers->second) {
+                rx_ids.push_back(s->rx_id);
+            }
+        }
+
+        return rx_ids;
+    }
+
+    std::chrono::steady_clock::time_point protocol::process_commands(std::chrono::steady_clock::time_point now) {
+        auto next_event = pick_commands(now);
+
+        // Sending may block on the transport, so it does not hold up threads adding or removing commands.
+        // The commands are already in flight, so their responses are matched even if they arrive right away.
+        for (auto &[s, msg_buf] : pending_sends) {
+            s->send_msg(msg_buf.data(), msg_buf.size());
+        }
+
+        pending_sends.clear();
+
+        return next_event;
+    }
+
+    std::chrono::steady_clock::time_point protocol::pick_commands(std::chrono::steady_clock::time_point now) {
+        std::lock_guard<std::mutex> commands_lock(commands_mutex);
+        auto next_event = std::chrono::steady_clock::time_point::max();
+
+        release_commands(now);
+
+        // Commands on different sockets can be in flight at the same time
+        for (auto &[s, ready] : ready_queues) {
+            socket_state &state = socket_states[s];
+
+            // Finish the outstanding command once it has been answered or timed out
+            if (state.in_flight && (state.responded || now >= state.deadline)) {
+                command_backend &c = *state.in_flight;
+
+                // !!! Stopping on errors is disabled for now, as it is breaking the simulator behaviour
+                if (!state.responded) {
+                    // Commands that did not respond last time use a lowered timeout, which says nothing about the ECU
+                    if (c.response_status != cmd_status::NO_RESPONSE) {
+                        state.rtt.add_timeout();
+                    }
 
-            process_command(c);
+                    c.set_response_status(cmd_status::NO_RESPONSE);
+                    c.clear_response();
+                }
+
+                if (now > c.deadline) {
+                    c.deadline_misses++;
+                }
 
-            auto start = std::chrono::steady_clock::now();
-            uint32_t timeout = command_process_timeout;
+                state.in_flight = nullptr;
 
-            // If no response is expected, lower timeout
-            if (c.response_status == cmd_status::NO_RESPONSE) {
-                timeout = no_response_command_timeout;
+                // Periods stay in phase, unless the command has fallen behind by more than a whole period
+                schedule_command(c, std::max(c.released_at + get_period(c), now));
             }
 
-            bool response_received = false;
+            // Send the released command with the earliest deadline
+            if (!state.in_flight && !ready.empty()) {
+                std::pop_heap(ready.begin(), ready.end(), schedule_entry_later());
+                command_backend &c = *ready.back().command;
+                ready.pop_back();
+
+                std::chrono::microseconds timeout = state.rtt.get_timeout(
+                    std::chrono::milliseconds(command_process_timeout_floor), 
+                    std::chrono::milliseconds(command_process_timeout)
+                );
+
+                // If no response is expected, lower timeout
+                if (c.response_status == cmd_status::NO_RESPONSE) {
+                    timeout = std::chrono::milliseconds(no_response_command_timeout);
+                }
+
+                pending_sends.emplace_back(s, c.get_can_msg());
 
-            // If for what ever reason the socket is not in the map, add it
-            if (command_socket_map.find(&c) == command_socket_map.end()) {
-                command_socket_map.emplace(&c, get_socket(c.tx_id, c.rx_id));
+                c.sent_at = std::chrono::steady_clock::now();
+                state.in_flight = &c;
+                state.responded = false;
+                state.deadline = c.sent_at + timeout;
             }
 
-            // Process incoming data from sockets until response is received
-            while (
-                !(response_received = process_socket(command_socket_map.at(&c), &c)) 
-                && (std::chrono::steady_clock::now() - start) < std::chrono::milliseconds(timeout)
-            ) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (state.in_flight && state.deadline < next_event) {
+                next_event = state.deadline;
             }
+        }
+
+        if (!release_queue.empty() && release_queue.front().at < next_event) {
+            next_event = release_queue.front().at;
+        }
 
-            // !!! This is disabled for now, as it is breaking the simulator behaviour
+        return next_event;
+    }
 
-            // if (c.response_status == cmd_status::ERROR) {
-            //     return;
-            // }
+    void protocol::release_commands(std::chrono::steady_clock::time_point now) {
+        // Move every command whose next period has started to the ready queue of its socket
+        while (!release_queue.empty() && release_queue.front().at <= now) {
+            std::pop_heap(release_queue.begin(), release_queue.end(), schedule_entry_later());
+            schedule_entry e = release_queue.back();
+            release_queue.pop_back();
 
-            if (!response_received) {
-                c.response_status = cmd_status::NO_RESPONSE;
-                c.response_buffer = {};
+            command_backend &c = *e.command;
+
+            // Stopped commands leave the schedule until they are resumed
+            if (!c.refresh) {
+                c.scheduled = false;
+                continue;
             }
 
-            new_command_queue.push(c);
+            c.released_at = e.at;
+            c.deadline = e.at + get_period(c);
+
+            std::vector<schedule_entry> &ready = ready_queues[&command_socket_map.at(&c).get()];
+            ready.push_back({ c.deadline, &c });
+            std::push_heap(ready.begin(), ready.end(), schedule_entry_later());
         }
+    }
 
-        command_queue.swap(new_command_queue);
+    void protocol::schedule_command(command_backend &c, std::chrono::steady_clock::time_point at) {
+        release_queue.push_back({ at, &c });
+        std::push_heap(release_queue.begin(), release_queue.end(), schedule_entry_later());
+        c.scheduled = true;
+    }
+
+    void protocol::unschedule_command(command_backend &c) {
+        // Scheduled commands are in the release queue, a ready queue or in flight
+        if (!c.scheduled) {
+            return;
+        }
+
+        auto is_command = [&c](const schedule_entry &e) { 
+            return e.command == &c; 
+        };
+
+        // Removing entries keeps the remaining ones valid heaps after rebuilding them
+        std::erase_if(release_queue, is_command);
+        std::make_heap(release_queue.begin(), release_queue.end(), schedule_entry_later());
+
+        for (auto &[s, ready] : ready_queues) {
+            if (std::erase_if(ready, is_command) > 0) {
+                std::make_heap(ready.begin(), ready.end(), schedule_entry_later());
+            }
+        }
+
+        c.scheduled = false;
+    }
+
+    void protocol::resume_command(command_backend &c) {
+        {
+            std::lock_guard<std::mutex> commands_lock(commands_mutex);
+
+            // Resumed commands are cyclic, even if they were created as one shot commands
+            c.one_shot = false;
+
+            if (c.scheduled || !command_socket_map.contains(&c)) {
+                return;
+            }
+
+            schedule_command(c, std::chrono::steady_clock::now());
+        }
+
+        wake_listener();
+    }
+
+    std::chrono::milliseconds protocol::get_period(const command_backend &c) const {
+        uint32_t ms = c.refresh_ms;
+        return std::chrono::milliseconds(ms != 0 ? ms : refresh_ms.load());
+    }
+
+    bool protocol::schedule_entry_later::operator()(const schedule_entry &a, const schedule_entry &b) const {
+        return a.at > b.at;
     }
 
     void protocol::process_command(command_backend &c) {
         std::vector<uint8_t> msg_buf = c.get_can_msg();
         
-        socket_wrapper &s = command_socket_map.at(&c);
-        s.send_msg(msg_buf.data(), msg_buf.size());
-    }
-
-    bool protocol::process_sockets() {
-        std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
+        commands_mutex.lock();
+        auto it = command_socket_map.find(&c);
 
-        // Go through each socket and process incoming messages
-        for (socket_wrapper &s : sockets) {
-            process_socket(s);
+        // A late response to an identical earlier request already completed the command
+        if (it == command_socket_map.end()) {
+            commands_mutex.unlock();
+            return;
         }
 
-        return false;
+        socket_wrapper &s = it->second;
+        c.sent_at = std::chrono::steady_clock::now();
+        commands_mutex.unlock();
+
+        s.send_msg(msg_buf.data(), msg_buf.size());
     }
 
-    bool protocol::process_socket(socket_wrapper &s, command_backend *command_to_check) {
+    bool protocol::process_socket(socket_wrapper &s) {
         uint8_t buffer[UDS_MSG_MAX];
         size_t size = s.read_msg(buffer, sizeof(buffer));
         bool cmd_response = false;
@@ -238,8 +432,9 @@ namespace obd2 {
         uint8_t sid = buffer[UDS_RES_SID];
         uint8_t pid = buffer[UDS_RES_PID];
         uint8_t *data = &buffer[UDS_RES_PID];
-        std::list<std::reference_wrapper<command_backend>> to_complete;
+        std::vector<command_backend *> to_complete;
         bool is_dtc = false;
+        auto recieved_at = std::chrono::steady_clock::now();
 
         // Check if response is negative or dtc response
         if (sid == UDS_SID_NEGATIVE) {
@@ -256,58 +451,66 @@ namespace obd2 {
 
         commands_mutex.lock();
 
-        // Go through each request and check if data is for specified request
-        // Only check pid if response is positive
-        for (auto &p : command_socket_map) {
-            command_backend *cmd = p.first;
+        socket_state &state = socket_states[&s];
 
-            if (cmd->tx_id != s.tx_id
-                || cmd->rx_id != s.rx_id
-                || cmd->sid != (sid - UDS_RX_SID_OFFSET) 
-                || (nrc == 0 && !is_dtc && !cmd->contains_pid(pid))) {
-                continue;
-            }
+        // Only positive responses carry the pid of the command
+        uint32_t dispatch_pid = (nrc != 0 || is_dtc) ? DISPATCH_ANY_PID : pid;
+        auto dispatch = dispatch_index.find({ &s, static_cast<uint8_t>(sid - UDS_RX_SID_OFFSET), dispatch_pid });
 
-            // When negative response and command status was not OK before,
-            // set command to contain error
+        if (dispatch == dispatch_index.end()) {
+            commands_mutex.unlock();
+            return false;
+        }
+
+        for (command_backend *cmd : dispatch->second) {
+            // When negative response and command status was not OK before, set command to contain error.
+            // ECUs that do not support a broadcast request may reject it, which says nothing about the others.
             if (nrc != 0) {
-                if (cmd->response_status == cmd_status::OK) {
+                if (cmd->response_status == cmd_status::OK || cmd->broadcast) {
                     continue;
                 }
 
-                std::vector neg_data = { nrc };
-
-                cmd->update_back_buffer(neg_data.data(), neg_data.data() + neg_data.size());
-                cmd->response_status = cmd_status::ERROR;
+                cmd->update_back_buffer(&nrc, &nrc + 1, cmd_status::ERROR);
             }
             else {
-                cmd->update_back_buffer(data, data + size - UDS_RES_PID);
+                cmd->update_back_buffer(data, data + size - UDS_RES_PID, cmd_status::OK, s.rx_id);
             }
 
-            // If command is not set to be refreshed, complete it after loop
-            if (!cmd->refresh) {
-                to_complete.push_back(*cmd);
+            // If command is not set to be refreshed, complete it after loop.
+            // Broadcast commands can not know how many ECUs respond, so they are completed by their owner.
+            if (cmd->one_shot && !cmd->broadcast) {
+                to_complete.push_back(cmd);
+            }
+
+            // Broadcast commands are in flight on the socket they were sent from
+            socket_state &cmd_state = cmd->broadcast ? socket_states[&command_socket_map.at(cmd).get()] : state;
+
+            // Measure the round trip time of the first response to the outstanding or a one shot command
+            if ((cmd == cmd_state.in_flight && !cmd_state.responded) || cmd->one_shot) {
+                cmd_state.rtt.add_sample(std::chrono::duration_cast<std::chrono::microseconds>(recieved_at - cmd->sent_at));
             }
 
-            // If the function should check for a specific command and the commands response is recieved, 
-            // set the corresponding flag
-            if (command_to_check && cmd == command_to_check) {
+            // If this is the response to the outstanding command of the socket, set the corresponding flag
+            if (cmd == cmd_state.in_flight) {
+                cmd_state.responded = true;
                 cmd_response = true;
             }
         }
 
-        commands_mutex.unlock();
-
-        // Complete commands that are not set to be refreshed
-        for (auto &cmd : to_complete) {
-            cmd.get().complete();
+        // Complete commands that are not set to be refreshed. This has to happen before unlocking, as waiting threads
+        // may destroy a command as soon as it has its response, which blocks on the commands mutex until then.
+        for (command_backend *cmd : to_complete) {
+            erase_command(*cmd);
         }
 
+        commands_mutex.unlock();
+
         return cmd_response;
     }
 
     void protocol::set_refresh_ms(uint32_t ms) {
         refresh_ms = ms;
+        wake_listener();
     }
 
     void protocol::set_refreshed_cb(const std::function<void(void)> &cb) {
@@ -315,6 +518,39 @@ namespace obd2 {
         refreshed_cb = cb;
     }
 
+    void protocol::set_response_timeout(uint32_t floor_ms, uint32_t ceiling_ms) {
+        if (floor_ms > ceiling_ms) {
+            throw std::invalid_argument("Response timeout floor must not exceed its ceiling");
+        }
+
+        command_process_timeout_floor = floor_ms;
+        command_process_timeout = ceiling_ms;
+    }
+
+    void protocol::set_broadcast_group(uint32_t tx_id, const std::vector<ecu_address> &ecus) {
+        std::lock_guard<std::mutex> commands_lock(commands_mutex);
+        std::vector<socket_wrapper *> &receivers = broadcast_receivers[tx_id];
+
+        receivers.clear();
+
+        // The physical sockets also send the flow control frames of multi frame responses
+        for (const ecu_address &a : ecus) {
+            receivers.push_back(&get_socket(a.tx_id, a.rx_id));
+        }
+    }
+
+    rtt_estimator protocol::get_rtt(uint32_t tx_id, uint32_t rx_id) {
+        std::lock_guard<std::mutex> commands_lock(commands_mutex);
+
+        for (auto &p : socket_states) {
+            if (p.first->tx_id == tx_id && p.first->rx_id == rx_id) {
+                return p.second.rtt;
+            }
+        }
+
+        return rtt_estimator();
+    }
+
     uint32_t protocol::get_refresh_ms() const {
         return refresh_ms.load();
     }
@@ -326,44 +562,56 @@ namespace obd2 {
     void protocol::add_command(command_backend &c) {
         std::lock_guard<std::mutex> commands_lock(commands_mutex);
 
-        // Check if identical command already exists
-        for (auto &p : command_socket_map) {
-            if (p.first->tx_id == c.tx_id 
-                && p.first->rx_id == c.rx_id
-                && p.first->sid == c.sid
-                && p.first->pids == c.pids) {
-                throw std::invalid_argument("Command already exists");
+        // Get required socket
+        socket_wrapper &socket = c.broadcast ? get_socket(c.tx_id, 0, true) : get_socket(c.tx_id, c.rx_id);
+        std::vector<socket_wrapper *> dispatch_sockets = get_dispatch_sockets(c, socket);
+
+        // Check if identical command already exists, only commands of the same socket and sid can be identical
+        auto same_sid = dispatch_sockets.empty() 
+            ? dispatch_index.end() 
+            : dispatch_index.find({ dispatch_sockets.front(), c.sid, DISPATCH_ANY_PID });
+
+        if (same_sid != dispatch_index.end()) {
+            for (command_backend *other : same_sid->second) {
+                if (other->pids == c.pids && other->tx_id == c.tx_id) {
+                    throw std::invalid_argument("Command already exists");
+                }
             }
         }
 
-        // Get required socket
-        socket_wrapper &socket = get_socket(c.tx_id, c.rx_id);
         command_socket_map.emplace(&c, socket);
+        index_command(c, socket);
+
+        // Commands that are not refreshed are sent once by the registry
+        c.one_shot = !c.refresh;
 
-        // Add command to queue
         if (c.refresh) {
-            command_queue.push(c);
+            schedule_command(c, std::chrono::steady_clock::now());
+            wake_listener();
         }
     }
 
     void protocol::remove_command(command_backend &c) {
         std::lock_guard<std::mutex> commands_lock(commands_mutex);
-        
-        command_socket_map.erase(&c);
+        erase_command(c);
+    }
 
-        // Remove command from queue
-        std::queue<std::reference_wrapper<command_backend>> new_command_queue;
+    void protocol::erase_command(command_backend &c) {
+        auto socket = command_socket_map.find(&c);
 
-        while (!command_queue.empty()) {
-            command_backend &tmp = command_queue.front();
-            command_queue.pop();
+        if (socket != command_socket_map.end()) {
+            unindex_command(c, socket->second);
+            command_socket_map.erase(socket);
+        }
 
-            if (&tmp != &c) {
-                new_command_queue.push(tmp);
+        // The listener must not wait for the response of a removed command
+        for (auto &p : socket_states) {
+            if (p.second.in_flight == &c) {
+                p.second.in_flight = nullptr;
             }
         }
 
-        command_queue.swap(new_command_queue);
+        unschedule_command(c);
         c.parent = nullptr;
     }
     
@@ -374,9 +622,119 @@ namespace obd2 {
         command_socket_map.erase(&old_ref);
         command_socket_map.emplace(&new_ref, socket);
 
+        // The schedule only refers to commands, so their entries keep their order
+        for (auto *queue : { &release_queue, &ready_queues[&socket] }) {
+            for (schedule_entry &e : *queue) {
+                if (e.command == &old_ref) {
+                    e.command = &new_ref;
+                }
+            }
+        }
+
+        for (auto &p : socket_states) {
+            if (p.second.in_flight == &old_ref) {
+                p.second.in_flight = &new_ref;
+            }
+        }
+
+        new_ref.scheduled = old_ref.scheduled;
+        new_ref.released_at = old_ref.released_at;
+        new_ref.deadline = old_ref.deadline;
+        old_ref.scheduled = false;
+
+        // The pids are moved after the command is, so the index entries are taken from the old instance
+        std::lock_guard<std::mutex> pids_lock(old_ref.pids_mutex);
+
+        for (socket_wrapper *s : get_dispatch_sockets(old_ref, socket)) {
+            for (uint32_t pid : old_ref.pids) {
+                std::vector<command_backend *> &entry = dispatch_index.at({ s, old_ref.sid, pid });
+                *std::find(entry.begin(), entry.end(), &old_ref) = &new_ref;
+            }
+
+            std::vector<command_backend *> &entry = dispatch_index.at({ s, old_ref.sid, DISPATCH_ANY_PID });
+            *std::find(entry.begin(), entry.end(), &old_ref) = &new_ref;
+        }
+
         old_ref.parent = nullptr;
     }
 
+    void protocol::add_command_pid(command_backend &c, uint16_t pid) {
+        std::lock_guard<std::mutex> commands_lock(commands_mutex);
+        auto socket = command_socket_map.find(&c);
+
+        if (socket == command_socket_map.end()) {
+            return;
+        }
+
+        for (socket_wrapper *s : get_dispatch_sockets(c, socket->second)) {
+            index_entry({ s, c.sid, pid }, c);
+        }
+    }
+
+    void protocol::remove_command_pid(command_backend &c, uint16_t pid) {
+        std::lock_guard<std::mutex> commands_lock(commands_mutex);
+        auto socket = command_socket_map.find(&c);
+
+        if (socket == command_socket_map.end()) {
+            return;
+        }
+
+        for (socket_wrapper *s : get_dispatch_sockets(c, socket->second)) {
+            unindex_entry({ s, c.sid, pid }, c);
+        }
+    }
+
+    size_t protocol::dispatch_key_hash::operator()(const dispatch_key &k) const {
+        return std::hash<socket_wrapper *>()(k.socket) ^ std::hash<uint32_t>()((static_cast<uint32_t>(k.sid) << 17) | k.pid);
+    }
+
+    void protocol::index_command(command_backend &c, socket_wrapper &s) {
+        std::lock_guard<std::mutex> pids_lock(c.pids_mutex);
+
+        for (socket_wrapper *d : get_dispatch_sockets(c, s)) {
+            index_entry({ d, c.sid, DISPATCH_ANY_PID }, c);
+
+            for (uint16_t pid : c.pids) {
+                index_entry({ d, c.sid, pid }, c);
+            }
+        }
+    }
+
+    void protocol::unindex_command(command_backend &c, socket_wrapper &s) {
+        std::lock_guard<std::mutex> pids_lock(c.pids_mutex);
+
+        for (socket_wrapper *d : get_dispatch_sockets(c, s)) {
+            unindex_entry({ d, c.sid, DISPATCH_ANY_PID }, c);
+
+            for (uint16_t pid : c.pids) {
+                unindex_entry({ d, c.sid, pid }, c);
+            }
+        }
+    }
+
+    void protocol::index_entry(const dispatch_key &k, command_backend &c) {
+        dispatch_index[k].push_back(&c);
+    }
+
+    void protocol::unindex_entry(const dispatch_key &k, command_backend &c) {
+        auto entry = dispatch_index.find(k);
+
+        if (entry == dispatch_index.end()) {
+            return;
+        }
+
+        // A command may contain a pid more than once, every occurence has its own entry
+        auto it = std::find(entry->second.begin(), entry->second.end(), &c);
+
+        if (it != entry->second.end()) {
+            entry->second.erase(it);
+        }
+
+        if (entry->second.empty()) {
+            dispatch_index.erase(entry);
+        }
+    }
+
     void protocol::call_refreshed_cb() {
         std::lock_guard<std::mutex> refreshed_cb_lock(refreshed_cb_mutex);
 
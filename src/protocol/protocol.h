@@ -1,58 +1,171 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "command/command.h"
+#include "command/response_view/response_slot_pool.h"
+#include "rtt_estimator/rtt_estimator.h"
 #include "socket_wrapper/socket_wrapper.h"
+#include "transport/transport.h"
 
 namespace obd2 {
     class command_backend;
 
     class protocol {
+        public:
+            // Physical addresses of an ECU, used for the members of a broadcast group
+            struct ecu_address {
+                uint32_t tx_id;
+                uint32_t rx_id;
+            };
+
         private:
+            // Listener state of each socket, only one command per socket is in flight at a time
+            struct socket_state {
+                command_backend *in_flight = nullptr;
+                bool responded = false;
+                std::chrono::steady_clock::time_point deadline; // Response timeout of the command in flight
+                rtt_estimator rtt;
+            };
+
+            // Cyclic commands are scheduled earliest deadline first. Once per period a command is released into
+            // the ready queue of its socket, where its deadline is the end of the period.
+            struct schedule_entry {
+                std::chrono::steady_clock::time_point at; // Release time in the release queue, deadline in ready queues
+                command_backend *command;
+            };
+
+            struct schedule_entry_later {
+                bool operator()(const schedule_entry &a, const schedule_entry &b) const;
+            };
+
+            // Responses are dispatched by socket, request sid and pid. DTC and negative responses carry no pid,
+            // so every command is also indexed with the wildcard pid.
+            struct dispatch_key {
+                socket_wrapper *socket;
+                uint8_t sid;
+                uint32_t pid;
+
+                bool operator==(const dispatch_key &k) const = default;
+            };
+
+            struct dispatch_key_hash {
+                size_t operator()(const dispatch_key &k) const;
+            };
+
+            static constexpr uint32_t DISPATCH_ANY_PID = 0x10000;
+
+            // Identical commands of a protocol share one backend, which is looked up by these parameters
+            struct command_key {
+                uint32_t tx_id;
+                uint32_t rx_id;
+                uint8_t sid;
+                std::vector<uint16_t> pids;
+
+                bool operator==(const command_key &k) const = default;
+            };
+
+            struct command_key_hash {
+                size_t operator()(const command_key &k) const;
+            };
+
+            std::unordered_multimap<command_key, std::unique_ptr<command_backend>, command_key_hash> backends;
+            std::mutex backends_mutex;
+
             std::unordered_map<command_backend *, std::reference_wrapper<socket_wrapper>> command_socket_map;
-            std::queue<std::reference_wrapper<command_backend>> command_queue;
+            std::unordered_map<dispatch_key, std::vector<command_backend *>, dispatch_key_hash> dispatch_index;
+            std::unordered_map<uint32_t, std::vector<socket_wrapper *>> broadcast_receivers; // Broadcast ID => receiving sockets
+            std::vector<schedule_entry> release_queue; // Heap ordered by release time
+            std::unordered_map<socket_wrapper *, std::vector<schedule_entry>> ready_queues; // Heaps ordered by deadline
             std::mutex commands_mutex;
 
-            std::vector<socket_wrapper> sockets;
+            // The transport has to outlive the sockets opened by it
+            std::unique_ptr<transport> transport_instance;
+            std::list<std::unique_ptr<socket_wrapper>> sockets;
+            std::unordered_map<socket_wrapper *, socket_state> socket_states;
             std::mutex sockets_mutex;
+
+            // Requests the listener picked under the commands mutex and sends after releasing it
+            std::vector<std::pair<socket_wrapper *, std::vector<uint8_t>>> pending_sends;
+
+            // Response slots of the commands, shared with them so it outlives the protocol while any command exists
+            std::shared_ptr<response_slot_pool> slot_pool = std::make_shared<response_slot_pool>();
             
-            uint32_t command_process_timeout = 1000;
+            // Response timeouts are derived from the measured round trip time of each socket within these bounds
+            std::atomic<uint32_t> command_process_timeout = 1000;
+            std::atomic<uint32_t> command_process_timeout_floor = 50;
             uint32_t no_response_command_timeout = 1;
 
             std::atomic<bool> recieved_response = false;
             std::atomic<bool> next_recieved_response = false;
 
-            unsigned int if_index;
             std::atomic<uint32_t> refresh_ms;
             std::thread listener_thread;
             std::atomic<bool> listener_running = false;
 
+            // Reactor used by the listener thread to wait for socket, refresh tick and wakeup events
+            int epoll_fd = -1;
+            int tick_fd = -1;
+            int wake_fd = -1;
+
             std::function<void(void)> refreshed_cb;
             std::mutex refreshed_cb_mutex;
 
+            void start_listener();
+            void stop_listener();
             void command_listener();
-            void process_commands();
-            bool process_sockets();
-            bool process_socket(socket_wrapper &s, command_backend *command_to_check = nullptr);
+            std::chrono::steady_clock::time_point process_commands(std::chrono::steady_clock::time_point now);
+            // Finishes answered or timed out commands and puts the next command of each free socket in flight
+            std::chrono::steady_clock::time_point pick_commands(std::chrono::steady_clock::time_point now);
+            void release_commands(std::chrono::steady_clock::time_point now);
+            void schedule_command(command_backend &c, std::chrono::steady_clock::time_point at);
+            void unschedule_command(command_backend &c);
+            void resume_command(command_backend &c);
+            std::chrono::milliseconds get_period(const command_backend &c) const;
+            bool process_socket(socket_wrapper &s);
             void process_command(command_backend &c);
-            socket_wrapper &get_socket(uint32_t tx_id, uint32_t rx_id);
+            socket_wrapper &get_socket(uint32_t tx_id, uint32_t rx_id, bool broadcast = false);
+            std::vector<socket_wrapper *> get_dispatch_sockets(command_backend &c, socket_wrapper &s);
+            std::vector<uint32_t> get_broadcast_receivers(uint32_t tx_id);
             void add_command(command_backend &c);
             void remove_command(command_backend &c);
+            void erase_command(command_backend &c);
             void move_command(command_backend &old_ref, command_backend &new_ref);
+            void add_command_pid(command_backend &c, uint16_t pid);
+            void remove_command_pid(command_backend &c, uint16_t pid);
             void call_refreshed_cb();
 
+            command_backend &acquire_backend(uint32_t tx_id, uint32_t rx_id, uint8_t sid, const std::vector<uint16_t> &pids, bool refresh);
+            void release_backend(command_backend &c);
+            void rekey_backend(command_backend &c, const std::vector<uint16_t> &old_pids);
+            void move_backends(protocol &p);
+            void orphan_backends();
+
+            void index_command(command_backend &c, socket_wrapper &s);
+            void unindex_command(command_backend &c, socket_wrapper &s);
+            void index_entry(const dispatch_key &k, command_backend &c);
+            void unindex_entry(const dispatch_key &k, command_backend &c);
+
+            void setup_reactor();
+            void close_reactor();
+            void watch_socket(socket_wrapper &s);
+            void wake_listener();
+            void arm_tick(std::chrono::steady_clock::time_point at);
+            bool wait_events(int timeout_ms);
+
         public:
             protocol();
             protocol(const char *if_name, uint32_t refresh_ms = 1000);
+            protocol(std::unique_ptr<transport> transport_instance, uint32_t refresh_ms = 1000);
             protocol(const protocol &p) = delete;
             protocol(protocol &&p);
             ~protocol();
@@ -62,10 +175,16 @@ namespace obd2 {
 
             void set_refresh_ms(uint32_t ms);
             void set_refreshed_cb(const std::function<void(void)> &cb);
+            void set_response_timeout(uint32_t floor_ms, uint32_t ceiling_ms);
+            // Commands sent to tx_id are broadcast and collect the responses of every ECU of the group.
+            // Has to be called before the first command is sent to tx_id.
+            void set_broadcast_group(uint32_t tx_id, const std::vector<ecu_address> &ecus);
             bool recieved_any_response();
+            rtt_estimator get_rtt(uint32_t tx_id, uint32_t rx_id);
 
             uint32_t get_refresh_ms() const;
 
             friend class command_backend;
+            friend class command;
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,130 @@
+#include "protocol.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <system_error>
+#include <unistd.h>
+
+#define REACTOR_MAX_EVENTS 16
+
+namespace obd2 {
+    void protocol::setup_reactor() {
+        if (epoll_fd >= 0) {
+            return;
+        }
+
+        if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+
+        if ((tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+            int err = errno;
+            close_reactor();
+            throw std::system_error(std::error_code(err, std::generic_category()));
+        }
+
+        if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            int err = errno;
+            close_reactor();
+            throw std::system_error(std::error_code(err, std::generic_category()));
+        }
+
+        // The addresses of the fd members are used to tell tick and wakeup events apart from socket events
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+
+        ev.data.ptr = &tick_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tick_fd, &ev);
+
+        ev.data.ptr = &wake_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+    }
+
+    void protocol::close_reactor() {
+        for (int *fd : { &epoll_fd, &tick_fd, &wake_fd }) {
+            if (*fd >= 0) {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+
+    void protocol::watch_socket(socket_wrapper &s) {
+        if (epoll_fd < 0) {
+            return;
+        }
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &s;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s.get_fd(), &ev) < 0 && errno != EEXIST) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+    }
+
+    void protocol::wake_listener() {
+        if (wake_fd < 0) {
+            return;
+        }
+
+        uint64_t value = 1;
+
+        // Can only fail if the counter would overflow, in which case the listener is woken up anyway
+        (void)!write(wake_fd, &value, sizeof(value));
+    }
+
+    void protocol::arm_tick(std::chrono::steady_clock::time_point at) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(at.time_since_epoch()).count();
+
+        // A zero expiration would disarm the timer
+        if (ns <= 0) {
+            ns = 1;
+        }
+
+        itimerspec spec = {};
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+
+        // steady_clock is based on CLOCK_MONOTONIC, so the time point can be used as absolute expiration
+        timerfd_settime(tick_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    bool protocol::wait_events(int timeout_ms) {
+        epoll_event events[REACTOR_MAX_EVENTS];
+        bool cmd_response = false;
+
+        int count = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, timeout_ms);
+
+        // Interrupted by a signal or timed out
+        if (count <= 0) {
+            return false;
+        }
+
+        for (int i = 0; i < count; i++) {
+            void *source = events[i].data.ptr;
+            uint64_t value;
+
+            if (source == &tick_fd) {
+                (void)!read(tick_fd, &value, sizeof(value));
+                continue;
+            }
+
+            if (source == &wake_fd) {
+                (void)!read(wake_fd, &value, sizeof(value));
+                continue;
+            }
+
+            // Sockets are level triggered, so remaining messages are reported by the next wait
+            if (process_socket(*static_cast<socket_wrapper *>(source))) {
+                cmd_response = true;
+            }
+        }
+
+        return cmd_response;
+    }
+}
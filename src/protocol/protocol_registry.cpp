@@ -0,0 +1,113 @@
+#include "protocol.h"
+
+#include <functional>
+
+#include "command/command_backend/command_backend.h"
+
+namespace obd2 {
+    size_t protocol::command_key_hash::operator()(const command_key &k) const {
+        size_t hash = std::hash<uint64_t>()((static_cast<uint64_t>(k.tx_id) << 32) | k.rx_id) ^ k.sid;
+
+        for (uint16_t pid : k.pids) {
+            hash = hash * 31 + pid;
+        }
+
+        return hash;
+    }
+
+    command_backend &protocol::acquire_backend(uint32_t tx_id, uint32_t rx_id, uint8_t sid, const std::vector<uint16_t> &pids, bool refresh) {
+        command_backend *created;
+
+        {
+            std::lock_guard<std::mutex> backends_lock(backends_mutex);
+            command_key key = { tx_id, rx_id, sid, pids };
+
+            {
+                std::lock_guard<std::mutex> commands_lock(commands_mutex);
+                auto range = backends.equal_range(key);
+
+                // Completed backends are kept until their last command is gone, but must not be reused
+                for (auto it = range.first; it != range.second; it++) {
+                    command_backend &c = *it->second;
+
+                    if (command_socket_map.contains(&c)) {
+                        c.usage++;
+                        return c;
+                    }
+                }
+            }
+
+            // The backend is only registered here, so identical commands of other threads find it right away
+            auto it = backends.emplace(std::move(key), std::make_unique<command_backend>(tx_id, rx_id, sid, pids, *this, refresh));
+            created = it->second.get();
+
+            created->owner = this;
+            created->usage = 1;
+        }
+
+        // Sending may block on the transport, so other threads can acquire backends meanwhile. The usage of
+        // this thread keeps the backend alive. A late response to an identical earlier request may complete
+        // it before it is sent, which process_command treats as done.
+        process_command(*created);
+
+        return *created;
+    }
+
+    void protocol::release_backend(command_backend &c) {
+        std::lock_guard<std::mutex> backends_lock(backends_mutex);
+
+        // Usage is only decremented with the lock held, so no other thread can acquire the backend in between
+        if (--c.usage > 0) {
+            return;
+        }
+
+        auto range = backends.equal_range({ c.tx_id, c.rx_id, c.sid, c.get_pids() });
+
+        for (auto it = range.first; it != range.second; it++) {
+            if (it->second.get() == &c) {
+                backends.erase(it);
+                return;
+            }
+        }
+    }
+
+    void protocol::rekey_backend(command_backend &c, const std::vector<uint16_t> &old_pids) {
+        std::lock_guard<std::mutex> backends_lock(backends_mutex);
+        auto range = backends.equal_range({ c.tx_id, c.rx_id, c.sid, old_pids });
+
+        for (auto it = range.first; it != range.second; it++) {
+            if (it->second.get() != &c) {
+                continue;
+            }
+
+            // Reinserting the node only rehashes it, the backend itself stays in place
+            auto node = backends.extract(it);
+            node.key().pids = c.get_pids();
+            backends.insert(std::move(node));
+
+            return;
+        }
+    }
+
+    void protocol::move_backends(protocol &p) {
+        std::lock_guard<std::mutex> backends_lock(backends_mutex);
+        std::lock_guard<std::mutex> other_backends_lock(p.backends_mutex);
+
+        orphan_backends();
+        backends = std::move(p.backends);
+
+        for (auto &b : backends) {
+            b.second->owner = this;
+        }
+    }
+
+    void protocol::orphan_backends() {
+        // Backends that are still in use by commands are released to them, the last command deletes the backend
+        for (auto &b : backends) {
+            b.second->owner = nullptr;
+            b.second.release();
+        }
+
+        backends.clear();
+    }
+}
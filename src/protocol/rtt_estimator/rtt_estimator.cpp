@@ -0,0 +1,59 @@
+#include "rtt_estimator.h"
+
+#include <algorithm>
+
+namespace obd2 {
+    rtt_estimator::rtt_estimator() : srtt(0), rttvar(0), sample_count(0), timeout_count(0), backoff(0) { }
+
+    void rtt_estimator::add_sample(std::chrono::microseconds rtt) {
+        if (sample_count == 0) {
+            srtt = rtt;
+            rttvar = rtt / 2;
+        }
+        else {
+            std::chrono::microseconds delta = srtt > rtt ? srtt - rtt : rtt - srtt;
+
+            rttvar = (3 * rttvar + delta) / 4;
+            srtt = (7 * srtt + rtt) / 8;
+        }
+
+        sample_count++;
+        backoff = 0;
+    }
+
+    void rtt_estimator::add_timeout() {
+        timeout_count++;
+
+        // Double the timeout for each consecutive timeout
+        if (backoff < MAX_BACKOFF) {
+            backoff++;
+        }
+    }
+
+    std::chrono::microseconds rtt_estimator::get_srtt() const {
+        return srtt;
+    }
+
+    std::chrono::microseconds rtt_estimator::get_rttvar() const {
+        return rttvar;
+    }
+
+    std::chrono::microseconds rtt_estimator::get_timeout(std::chrono::microseconds floor, std::chrono::microseconds ceiling) const {
+        // Without any measurement, the full timeout has to be used
+        if (sample_count == 0) {
+            return ceiling;
+        }
+
+        std::chrono::microseconds timeout = (srtt + 4 * rttvar) * (1 << backoff);
+
+        return std::clamp(timeout, floor, std::max(floor, ceiling));
+    }
+
+    uint32_t rtt_estimator::get_sample_count() const {
+        return sample_count;
+    }
+
+    uint32_t rtt_estimator::get_timeout_count() const {
+        return timeout_count;
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace obd2 {
+    // Smoothed round trip time estimation of a socket, as used for TCP retransmission timeouts (RFC 6298)
+    class rtt_estimator {
+        public:
+            rtt_estimator();
+
+            void add_sample(std::chrono::microseconds rtt);
+            void add_timeout();
+
+            std::chrono::microseconds get_srtt() const;
+            std::chrono::microseconds get_rttvar() const;
+            std::chrono::microseconds get_timeout(std::chrono::microseconds floor, std::chrono::microseconds ceiling) const;
+            uint32_t get_sample_count() const;
+            uint32_t get_timeout_count() const;
+
+        private:
+            static constexpr uint8_t MAX_BACKOFF = 6;
+
+            std::chrono::microseconds srtt;
+            std::chrono::microseconds rttvar;
+            uint32_t sample_count;
+            uint32_t timeout_count;
+            uint8_t backoff;
+    };
+}
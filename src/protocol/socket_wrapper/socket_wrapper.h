@@ -5,24 +5,29 @@
 #include <vector>
 
 namespace obd2 {    
+    // Connection to a single ECU over a transport, addressed by the IDs used for sending and receiving
     class socket_wrapper {
-        private:
+        protected:
             uint32_t tx_id;
             uint32_t rx_id;
-            int fd;
         
         public:
-            socket_wrapper(uint32_t tx_id, uint32_t rx_id, unsigned int if_index);
+            socket_wrapper(uint32_t tx_id, uint32_t rx_id);
             socket_wrapper(const socket_wrapper &s) = delete;
-            socket_wrapper(socket_wrapper &&s);
-            ~socket_wrapper();
+            virtual ~socket_wrapper();
             
             socket_wrapper &operator=(const socket_wrapper &s) = delete;
-            socket_wrapper &operator=(socket_wrapper &&s);
 
-            size_t read_msg(void *data, size_t size);
-            void send_msg(void *data, size_t size);
+            uint32_t get_tx_id() const;
+            uint32_t get_rx_id() const;
+
+            // Reads a single message without blocking, returns 0 if no message is available
+            virtual size_t read_msg(void *data, size_t size) = 0;
+            virtual void send_msg(const void *data, size_t size) = 0;
+
+            // File descriptor that becomes readable when a message can be read
+            virtual int get_fd() const = 0;
 
             friend class protocol;
     };
-}
\ No newline at end of file
+}
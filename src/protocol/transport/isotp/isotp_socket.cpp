@@ -0,0 +1,100 @@
+#include "isotp_socket.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/can/isotp.h>
+#include <system_error>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#define UDS_PADDING_RX 0x00
+#define UDS_PADDING_TX 0xCC
+
+// Only defined by the headers of kernels that support functional addressing (5.11+)
+#ifndef CAN_ISOTP_SF_BROADCAST
+#define CAN_ISOTP_SF_BROADCAST 0x0800
+#endif
+
+namespace obd2 {
+    isotp_socket::isotp_socket(uint32_t tx_id, uint32_t rx_id, unsigned int if_index, bool broadcast) 
+        : socket_wrapper(tx_id, rx_id), fd(-1) {
+        int s;
+
+        can_isotp_options isotp_opt;
+        sockaddr_can addr;
+
+        if ((s = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+
+        // Setup ISO-TP options
+        isotp_opt = {};
+        isotp_opt.txpad_content = UDS_PADDING_TX;
+        isotp_opt.rxpad_content = UDS_PADDING_RX;
+        isotp_opt.flags = CAN_ISOTP_TX_PADDING | CAN_ISOTP_RX_PADDING;
+
+        // Functional requests are single frames sent to every ECU, the rx id is not evaluated by the kernel then
+        if (broadcast) {
+            isotp_opt.flags |= CAN_ISOTP_SF_BROADCAST;
+        }
+
+        if (setsockopt(s, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &isotp_opt, sizeof(isotp_opt)) < 0) {
+            close(s);
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+
+        // Setup CAN adress
+        addr = {};
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = static_cast<int>(if_index);
+        addr.can_addr.tp.tx_id = tx_id;
+        addr.can_addr.tp.rx_id = rx_id;
+
+        // Bind address to socket
+        if (bind(s, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+            close(s);
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+
+        // Enable non blocking read
+        int flags = fcntl(s, F_GETFL, 0);
+        fcntl(s, F_SETFL, flags | O_NONBLOCK);
+
+        fd = s;
+    }
+
+    isotp_socket::~isotp_socket() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    size_t isotp_socket::read_msg(void *data, size_t size) {
+        ssize_t nbytes = read(fd, data, size);
+
+        // An error occured => Do not return anything
+        if (nbytes <= 0) {
+            return 0;
+        }
+
+        return static_cast<size_t>(nbytes);
+    }
+ 
+    void isotp_socket::send_msg(const void *data, size_t size) {
+        while (write(fd, data, size) < 0) {
+            if (errno != EAGAIN) {
+                return;
+            }
+
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    int isotp_socket::get_fd() const {
+        return fd;
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+#include "../../socket_wrapper/socket_wrapper.h"
+
+namespace obd2 {
+    class isotp_socket : public socket_wrapper {
+        private:
+            int fd;
+
+        public:
+            isotp_socket(uint32_t tx_id, uint32_t rx_id, unsigned int if_index, bool broadcast = false);
+            isotp_socket(const isotp_socket &s) = delete;
+            ~isotp_socket();
+
+            isotp_socket &operator=(const isotp_socket &s) = delete;
+
+            size_t read_msg(void *data, size_t size) override;
+            void send_msg(const void *data, size_t size) override;
+            int get_fd() const override;
+    };
+}
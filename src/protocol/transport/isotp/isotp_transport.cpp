@@ -0,0 +1,24 @@
+#include "isotp_transport.h"
+
+#include <cerrno>
+#include <net/if.h>
+#include <system_error>
+
+#include "isotp_socket.h"
+
+namespace obd2 {
+    isotp_transport::isotp_transport(const char *if_name) {
+        // Get index of specified CAN interface name
+        if ((if_index = if_nametoindex(if_name)) == 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+    }
+
+    std::unique_ptr<socket_wrapper> isotp_transport::open(uint32_t tx_id, uint32_t rx_id) {
+        return std::make_unique<isotp_socket>(tx_id, rx_id, if_index);
+    }
+
+    std::unique_ptr<socket_wrapper> isotp_transport::open_broadcast(uint32_t tx_id) {
+        return std::make_unique<isotp_socket>(tx_id, 0, if_index, true);
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "../transport.h"
+
+namespace obd2 {
+    // Linux SocketCAN ISO-TP transport
+    class isotp_transport : public transport {
+        private:
+            unsigned int if_index;
+
+        public:
+            isotp_transport(const char *if_name);
+
+            std::unique_ptr<socket_wrapper> open(uint32_t tx_id, uint32_t rx_id) override;
+            std::unique_ptr<socket_wrapper> open_broadcast(uint32_t tx_id) override;
+    };
+}
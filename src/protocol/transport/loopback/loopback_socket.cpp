@@ -0,0 +1,69 @@
+#include "loopback_socket.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "loopback_transport.h"
+
+namespace obd2 {
+    loopback_socket::loopback_socket(uint32_t tx_id, uint32_t rx_id, loopback_transport &parent) 
+        : socket_wrapper(tx_id, rx_id), parent(&parent) {
+        if ((event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+    }
+
+    loopback_socket::~loopback_socket() {
+        if (parent) {
+            parent->detach(*this);
+        }
+
+        close(event_fd);
+    }
+
+    size_t loopback_socket::read_msg(void *data, size_t size) {
+        std::lock_guard<std::mutex> rx_queue_lock(rx_queue_mutex);
+
+        if (rx_queue.empty()) {
+            return 0;
+        }
+
+        std::vector<uint8_t> msg = std::move(rx_queue.front());
+        rx_queue.pop();
+
+        // Reset readiness once every message has been read
+        if (rx_queue.empty()) {
+            uint64_t value;
+            (void)!read(event_fd, &value, sizeof(value));
+        }
+
+        // Like a datagram socket, excess data of the message is discarded
+        size_t nbytes = std::min(size, msg.size());
+        std::memcpy(data, msg.data(), nbytes);
+
+        return nbytes;
+    }
+
+    void loopback_socket::send_msg(const void *data, size_t size) {
+        if (parent) {
+            parent->transmit(tx_id, data, size);
+        }
+    }
+
+    int loopback_socket::get_fd() const {
+        return event_fd;
+    }
+
+    void loopback_socket::deliver(const std::vector<uint8_t> &data) {
+        std::lock_guard<std::mutex> rx_queue_lock(rx_queue_mutex);
+
+        rx_queue.push(data);
+
+        uint64_t value = 1;
+        (void)!write(event_fd, &value, sizeof(value));
+    }
+}
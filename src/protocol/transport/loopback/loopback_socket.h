@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include "../../socket_wrapper/socket_wrapper.h"
+
+namespace obd2 {
+    class loopback_transport;
+
+    class loopback_socket : public socket_wrapper {
+        private:
+            loopback_transport *parent;
+            int event_fd;
+
+            std::queue<std::vector<uint8_t>> rx_queue;
+            std::mutex rx_queue_mutex;
+
+            void deliver(const std::vector<uint8_t> &data);
+
+        public:
+            loopback_socket(uint32_t tx_id, uint32_t rx_id, loopback_transport &parent);
+            loopback_socket(const loopback_socket &s) = delete;
+            ~loopback_socket();
+
+            loopback_socket &operator=(const loopback_socket &s) = delete;
+
+            size_t read_msg(void *data, size_t size) override;
+            void send_msg(const void *data, size_t size) override;
+            int get_fd() const override;
+
+            friend class loopback_transport;
+    };
+}
@@ -0,0 +1,111 @@
+#include "loopback_transport.h"
+
+#include "loopback_socket.h"
+
+namespace obd2 {
+    loopback_transport::loopback_transport(const ecu_handler &handler) : handler(handler) { }
+
+    loopback_transport::~loopback_transport() {
+        {
+            std::lock_guard<std::mutex> delivery_lock(delivery_mutex);
+            delivery_running = false;
+        }
+
+        delivery_cv.notify_all();
+
+        if (delivery_thread.joinable()) {
+            delivery_thread.join();
+        }
+
+        std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
+
+        // Sockets that outlive the transport can not transmit anymore
+        for (loopback_socket *s : sockets) {
+            s->parent = nullptr;
+        }
+    }
+
+    std::unique_ptr<socket_wrapper> loopback_transport::open(uint32_t tx_id, uint32_t rx_id) {
+        auto s = std::make_unique<loopback_socket>(tx_id, rx_id, *this);
+
+        std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
+        sockets.push_back(s.get());
+
+        return s;
+    }
+
+    std::unique_ptr<socket_wrapper> loopback_transport::open_broadcast(uint32_t tx_id) {
+        // No response is ever sent to ID 0, so the socket only transmits
+        return open(tx_id, 0);
+    }
+
+    void loopback_transport::transmit(uint32_t tx_id, const void *data, size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        message request = { .id = tx_id, .data = std::vector<uint8_t>(bytes, bytes + size) };
+
+        if (!handler) {
+            return;
+        }
+
+        std::vector<message> responses = handler(request);
+        auto now = std::chrono::steady_clock::now();
+
+        for (message &response : responses) {
+            if (response.delay.count() <= 0) {
+                deliver(response);
+                continue;
+            }
+
+            std::lock_guard<std::mutex> delivery_lock(delivery_mutex);
+
+            if (!delivery_thread.joinable()) {
+                delivery_running = true;
+                delivery_thread = std::thread(&loopback_transport::deliver_delayed, this);
+            }
+
+            delayed.emplace(now + response.delay, std::move(response));
+            delivery_cv.notify_all();
+        }
+    }
+
+    void loopback_transport::deliver(const message &response) {
+        std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
+
+        // Every socket listening on the ID of a response receives it, like on a real bus
+        for (loopback_socket *s : sockets) {
+            if (s->rx_id == response.id) {
+                s->deliver(response.data);
+            }
+        }
+    }
+
+    void loopback_transport::deliver_delayed() {
+        std::unique_lock<std::mutex> delivery_lock(delivery_mutex);
+
+        while (delivery_running) {
+            if (delayed.empty()) {
+                delivery_cv.wait(delivery_lock);
+                continue;
+            }
+
+            auto due = delayed.begin()->first;
+
+            if (std::chrono::steady_clock::now() < due) {
+                delivery_cv.wait_until(delivery_lock, due);
+                continue;
+            }
+
+            message response = std::move(delayed.begin()->second);
+            delayed.erase(delayed.begin());
+
+            delivery_lock.unlock();
+            deliver(response);
+            delivery_lock.lock();
+        }
+    }
+
+    void loopback_transport::detach(loopback_socket &s) {
+        std::lock_guard<std::mutex> sockets_lock(sockets_mutex);
+        sockets.remove(&s);
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../transport.h"
+
+namespace obd2 {
+    class loopback_socket;
+
+    // In process transport that passes every sent message directly to a software ECU
+    class loopback_transport : public transport {
+        public:
+            struct message {
+                uint32_t id;
+                std::vector<uint8_t> data;
+                std::chrono::microseconds delay = std::chrono::microseconds(0); // Time until a response is delivered
+            };
+
+            // Called for every sent message, returns the responses of the simulated ECUs.
+            // The handler may be called from the listener and any thread sending one shot commands.
+            using ecu_handler = std::function<std::vector<message>(const message &request)>;
+
+            loopback_transport(const ecu_handler &handler);
+            loopback_transport(const loopback_transport &t) = delete;
+            ~loopback_transport();
+
+            loopback_transport &operator=(const loopback_transport &t) = delete;
+
+            std::unique_ptr<socket_wrapper> open(uint32_t tx_id, uint32_t rx_id) override;
+            std::unique_ptr<socket_wrapper> open_broadcast(uint32_t tx_id) override;
+
+        private:
+            ecu_handler handler;
+
+            std::list<loopback_socket *> sockets;
+            std::mutex sockets_mutex;
+
+            // Delayed responses are delivered by a thread, so the sender does not wait for them
+            std::multimap<std::chrono::steady_clock::time_point, message> delayed;
+            std::thread delivery_thread;
+            bool delivery_running = false;
+            std::mutex delivery_mutex;
+            std::condition_variable delivery_cv;
+
+            void transmit(uint32_t tx_id, const void *data, size_t size);
+            void deliver(const message &response);
+            void deliver_delayed();
+            void detach(loopback_socket &s);
+
+            friend class loopback_socket;
+    };
+}
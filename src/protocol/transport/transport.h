@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "../socket_wrapper/socket_wrapper.h"
+
+namespace obd2 {
+    // Backend used by the protocol to open connections to ECUs
+    class transport {
+        public:
+            virtual ~transport() = default;
+
+            virtual std::unique_ptr<socket_wrapper> open(uint32_t tx_id, uint32_t rx_id) = 0;
+
+            // Opens a send only connection for functional addressing, the responses are received by the
+            // regular connections of the ECUs
+            virtual std::unique_ptr<socket_wrapper> open_broadcast(uint32_t tx_id) = 0;
+    };
+}
@@ -11,7 +11,9 @@ namespace obd2 {
     req_combination::req_combination(uint32_t ecu_id, uint8_t sid, uint16_t pid, protocol &protocol_instance, bool refresh, bool allow_pid_chain)
         : cmd(ecu_id, ecu_id + OBD2_ID_OFFSET, sid, pid, protocol_instance, refresh), allow_pid_chain(allow_pid_chain) { }
 
-    req_combination::req_combination(req_combination &&c) : cmd(std::move(c.cmd)), requests(std::move(c.requests)), allow_pid_chain(c.allow_pid_chain) { }
+    req_combination::req_combination(req_combination &&c) 
+        : cmd(std::move(c.cmd)), requests(std::move(c.requests)), allow_pid_chain(c.allow_pid_chain), subscribed(c.subscribed.load()), 
+          var_counts(std::move(c.var_counts)) { }
     
     req_combination &req_combination::operator=(req_combination &&c) {
         if (this == &c) {
@@ -20,7 +22,12 @@ namespace obd2 {
 
         cmd = std::move(c.cmd);
         allow_pid_chain = c.allow_pid_chain;
+        subscribed = c.subscribed.load();
         requests = std::move(c.requests);
+        var_counts = std::move(c.var_counts);
+
+        std::lock_guard<std::mutex> layout_lock(layout_mutex);
+        layout_generation = 0;
 
         return *this;
     }
@@ -31,6 +38,7 @@ namespace obd2 {
 
     void req_combination::add_request(request &r) {
         requests.push_back(std::ref(r));
+        update_var_count(r.get_pid());
 
         if (cmd.contains_pid(r.get_pid())) {
             return;
@@ -41,6 +49,7 @@ namespace obd2 {
 
     bool req_combination::remove_request(request &r) {
         requests.erase(std::find(requests.begin(), requests.end(), r));
+        update_var_count(r.get_pid());
 
         for (request &req : requests) {
             if (req.get_pid() == r.get_pid()) {
@@ -73,6 +82,32 @@ namespace obd2 {
         cmd.resume();
     }
 
+    void req_combination::update_refresh_ms(uint32_t default_ms) {
+        uint32_t ms = 0;
+        bool uses_default = false;
+
+        // The command is sent as often as its fastest refreshed request needs it
+        for (request &r : requests) {
+            if (!r.get_refresh()) {
+                continue;
+            }
+
+            if (r.get_refresh_ms() == 0) {
+                uses_default = true;
+            }
+            else if (ms == 0 || r.get_refresh_ms() < ms) {
+                ms = r.get_refresh_ms();
+            }
+        }
+
+        // Without any own rate the command follows the refresh rate of the protocol, including later changes
+        if (uses_default && ms != 0) {
+            ms = std::min(ms, default_ms);
+        }
+
+        cmd.set_refresh_ms(ms);
+    }
+
     command &req_combination::get_command() {
         return cmd;
     }
@@ -86,24 +121,107 @@ namespace obd2 {
     }
     
     size_t req_combination::get_var_count(uint16_t pid) {
+        std::lock_guard<std::mutex> layout_lock(layout_mutex);
+        return find_var_count(pid);
+    }
+
+    size_t req_combination::get_response_size() {
+        std::vector<uint16_t> pids = cmd.get_pids();
+        size_t size = 1;
+
+        std::lock_guard<std::mutex> layout_lock(layout_mutex);
+
+        for (uint16_t pid : pids) {
+            size += 1 + find_var_count(pid);
+        }
+
+        return size;
+    }
+
+    const std::list<std::reference_wrapper<request>> &req_combination::get_requests() const {
+        return requests;
+    }
+
+    response_view req_combination::get_pid_data(const response_view &data, uint16_t pid) {
+        if (pid >= layout.size()) {
+            return response_view();
+        }
+
+        std::lock_guard<std::mutex> layout_lock(layout_mutex);
+
+        // The layout only has to be rebuilt once for every response
+        if (data.get_generation() != layout_generation) {
+            build_layout(data);
+        }
+
+        const pid_layout &l = layout[pid];
+
+        if (l.stamp != layout_stamp) {
+            return response_view();
+        }
+
+        return data.subview(l.offset, l.size);
+    }
+
+    void req_combination::update_var_count(uint16_t pid) {
         size_t count = 0;
+        bool found = false;
 
         for (request &r : requests) {
             if (r.get_pid() != pid) {
                 continue;
             }
             
-            size_t tmp = r.get_expected_size();
+            count = std::max(count, r.get_expected_size());
+            found = true;
+        }
 
-            if (tmp > count) {
-                count = tmp;
-            }
+        std::lock_guard<std::mutex> layout_lock(layout_mutex);
+
+        // The size of a removed pid is kept, as readers may still lay out a response sent before its removal
+        if (found) {
+            var_counts[pid] = count;
         }
 
-        return count;
+        // The sizes of the pids determine the layout
+        layout_generation = 0;
+    }
+
+    size_t req_combination::find_var_count(uint16_t pid) const {
+        auto it = var_counts.find(pid);
+        return it == var_counts.end() ? 0 : it->second;
+    }
+
+    void req_combination::build_layout(const response_view &data) {
+        // Entries of older layouts are invalidated by the new stamp instead of clearing the table
+        layout_stamp++;
+        layout_generation = data.get_generation();
+
+        for (size_t i = 0; i < data.size(); ) {
+            pid_layout &l = layout[data[i]];
+
+            l.stamp = layout_stamp;
+            l.offset = i + 1;
+            l.size = find_var_count(data[i]);
+
+            i += l.size + 1;
+        }
+
+        // A response overwritten while it was read is laid out again the next time
+        if (!data.is_intact()) {
+            layout_generation = 0;
+        }
     }
 
     bool req_combination::get_allow_pid_chain() const {
         return allow_pid_chain;
     }
+
+    void req_combination::set_subscribed(bool subscribed) {
+        this->subscribed = subscribed;
+    }
+
+    bool req_combination::is_subscribed() const {
+        return subscribed;
+    }
 }
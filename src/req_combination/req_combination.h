@@ -1,14 +1,40 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
 #include "../request/request.h"
 #include "../protocol/protocol.h"
 
 namespace obd2 {
     class req_combination {
         private:
+            // Location of the data of a pid in a chained response, only valid if the stamp matches the current layout
+            struct pid_layout {
+                uint64_t stamp = 0;
+                uint16_t offset = 0;
+                uint16_t size = 0;
+            };
+
             command cmd;
             std::list<std::reference_wrapper<request>> requests;
             bool allow_pid_chain;
+            std::atomic<bool> subscribed = false; // Read by the listener to skip combinations nobody subscribed to
+
+            // Largest expected data size of the requests of each pid, also of removed pids, guarded by the layout mutex
+            std::unordered_map<uint16_t, size_t> var_counts;
+
+            // Layout of the response with layout_generation, chained responses only contain 8 bit pids
+            std::array<pid_layout, 256> layout;
+            uint64_t layout_generation = 0;
+            uint64_t layout_stamp = 0;
+            std::mutex layout_mutex;
+
+            void update_var_count(uint16_t pid);
+            size_t find_var_count(uint16_t pid) const;
+            void build_layout(const response_view &data);
 
         public:
             req_combination();
@@ -26,11 +52,18 @@ namespace obd2 {
             void move_request(request &old_ref, request &new_ref);
             void request_stopped();
             void request_resumed();
+            void update_refresh_ms(uint32_t default_ms);
             
             size_t get_pid_count();
             size_t get_var_count(uint16_t pid);
+            // Expected size of a response including the sid and the pid bytes
+            size_t get_response_size();
+            const std::list<std::reference_wrapper<request>> &get_requests() const;
+            response_view get_pid_data(const response_view &data, uint16_t pid);
             bool contains_pid(uint16_t pid);
             bool get_allow_pid_chain() const;
+            void set_subscribed(bool subscribed);
+            bool is_subscribed() const;
             command &get_command();
     };
 }
\ No newline at end of file
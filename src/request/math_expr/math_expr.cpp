@@ -11,10 +11,29 @@ namespace obd2 {
     math_expr::math_expr() : math_expr("") {}
 
     math_expr::math_expr(const std::string &formula) {
+        std::unique_ptr<node> root = parse(formula);
+
+        // Flatten the tree into a stack program, so solving does not need to chase pointers
+        if (compile(*root) > MAX_STACK_SIZE) {
+            throw std::invalid_argument("Formula is nested too deeply");
+        }
+
+        // Most PID formulas only scale and offset an integer, which can be solved with a single multiply-add
+        is_affine = detect_affine(*root);
+
+        // Other formulas of a single byte only have 256 possible results
+        if (!is_affine) {
+            build_lookup_table();
+        }
+    }
+
+    std::unique_ptr<math_expr::node> math_expr::parse(const std::string &formula) {
+        std::unique_ptr<node> n = std::make_unique<node>();
+
         if (formula == "") {
-            value_raw = 0.0;
-            operation = RAW;
-            return;
+            n->value_raw = 0.0;
+            n->operation = RAW;
+            return n;
         }
 
         std::string tmp_formula = strip_parentheses(formula);
@@ -22,90 +41,89 @@ namespace obd2 {
         
         // Check if operator was found
         if (op_pos != std::string::npos) {
-            operation = math_op(tmp_formula[op_pos]);
-            left = std::make_unique<math_expr>(tmp_formula.substr(0, op_pos));
+            n->operation = math_op(tmp_formula[op_pos]);
+            n->left = parse(tmp_formula.substr(0, op_pos));
             size_t len = tmp_formula.size() - (op_pos + 1);
-            right = std::make_unique<math_expr>(tmp_formula.substr(op_pos + 1, len));
+            n->right = parse(tmp_formula.substr(op_pos + 1, len));
 
-            optimize_raw();
-            return;
+            optimize_raw(*n);
+            return n;
         }
 
-        if (parse_raw(tmp_formula)) {
-            return;
+        if (parse_raw(*n, tmp_formula)) {
+            return n;
         }
 
-        if (parse_variable(tmp_formula)) {
-            return;
+        if (parse_variable(*n, tmp_formula)) {
+            return n;
         }
 
         throw std::invalid_argument("Invalid usage of variable or raw value");
     }
 
-    math_expr::math_expr(const math_expr &e) 
-        : operation(e.operation), value_index(e.value_index), value_mask(e.value_mask), 
-            value_shift(e.value_shift), value_raw(e.value_raw), variable_count(e.variable_count) {
-        if (e.left) {
-            left = std::make_unique<math_expr>(*e.left);
-        }
-
-        if (e.right) {
-            right = std::make_unique<math_expr>(*e.right);
-        }
+    float math_expr::solve(const std::vector<uint8_t> &input_values) const {
+        return solve(input_values.data(), input_values.size());
     }
 
-    math_expr::math_expr(math_expr &&e) 
-        : operation(e.operation), left(std::move(e.left)), 
-            right(std::move(e.right)), value_index(e.value_index), value_mask(e.value_mask), 
-            value_shift(e.value_shift), value_raw(e.value_raw), variable_count(e.variable_count) { }
+    float math_expr::solve(std::span<const uint8_t> input_values) const {
+        return solve(input_values.data(), input_values.size());
+    }
 
-    math_expr &math_expr::operator=(math_expr &e) {
-        if (e.left) {
-            left = std::make_unique<math_expr>(*e.left);
-        }
-        else {
-            left = nullptr;
+    float math_expr::solve(const uint8_t *input_values, size_t size) const {
+        if (lookup_table) {
+            // A missing byte is solved like a zero byte
+            return (*lookup_table)[lookup_index < size ? input_values[lookup_index] : 0];
         }
 
-        if (e.right) {
-            right = std::make_unique<math_expr>(*e.right);
-        }
-        else {
-            right = nullptr;
-        }
+        if (is_affine) {
+            uint32_t raw = 0;
 
-        operation = e.operation;
-        value_index = e.value_index;
-        value_mask = e.value_mask;
-        value_shift = e.value_shift;
-        value_raw = e.value_raw;
-        variable_count = e.variable_count;
-        
-        return *this;
-    }
+            // Missing bytes are treated as zero, just like missing variables
+            for (uint8_t i = 0; i < affine.byte_count; i++) {
+                size_t index = affine.little_endian 
+                    ? affine.first_index + affine.byte_count - 1 - i 
+                    : affine.first_index + i;
 
-    math_expr &math_expr::operator=(math_expr &&e) {
-        operation = e.operation;
-        left = std::move(e.left);
-        right = std::move(e.right);
-        value_index = e.value_index;
-        value_mask = e.value_mask;
-        value_shift = e.value_shift;
-        value_raw = e.value_raw;
-        variable_count = e.variable_count;
-
-        return *this;
-    }
+                raw = (raw << 8) | (index < size ? input_values[index] : 0);
+            }
 
-    float math_expr::solve(const std::vector<uint8_t> &input_values) {
-        float left_val = 0.0;
-        float right_val = 0.0;
+            float value = raw * affine.scale + affine.bias;
+
+            if (affine.divisor != 1.0f) {
+                value /= affine.divisor;
+            }
 
-        if (left && right) {
-            left_val = left->solve(input_values);
-            right_val = right->solve(input_values);
+            return value + affine.offset;
+        }
+
+        float stack[MAX_STACK_SIZE];
+        size_t top = 0;
+
+        for (const instruction &i : program) {
+            switch (i.operation) {
+                case VARIABLE:
+                    if (i.value_index >= size) {
+                        stack[top++] = 0.0;
+                        break;
+                    }
+
+                    // TODO: allow twos complement
+                    stack[top++] = (input_values[i.value_index] & i.value_mask) >> i.value_shift;
+                    break;
+                case RAW:
+                    stack[top++] = i.value_raw;
+                    break;
+                default:
+                    top--;
+                    stack[top - 1] = apply(i.operation, stack[top - 1], stack[top]);
+                    break;
+            }
         }
 
+        return stack[0];
+    }
+
+    float math_expr::apply(math_op operation, float left_val, float right_val) {
         switch (operation)
         {
             case ADDITION:
@@ -122,65 +140,301 @@ namespace obd2 {
                 return left_val / right_val;
             case EXPONENTIATION:
                 return std::pow(left_val, right_val);
-            case VARIABLE:
-                if (value_index >= input_values.size()) {
-                    return 0.0;
-                }
-
-                // TODO: allow twos complement
-                return (input_values[value_index] & value_mask) >> value_shift;
-            case RAW:
-                return value_raw;
 
             default:
                 return 0.0;
         }
     }
 
-    uint32_t math_expr::get_variable_count() {
-        if (variable_count != -1) {
-            return variable_count;
+    uint32_t math_expr::get_variable_count() const {
+        return variable_count;
+    }
+
+    size_t math_expr::compile(const node &n) {
+        if (n.operation == VARIABLE || n.operation == RAW) {
+            program.push_back({ n.operation, n.value_index, n.value_mask, n.value_shift, n.value_raw });
+
+            if (n.operation == VARIABLE && n.value_index + 1u > variable_count) {
+                variable_count = n.value_index + 1;
+            }
+
+            return 1;
         }
 
-        uint32_t count = 0;
-        
-        if (operation == VARIABLE) {
-            count = value_index + 1;
+        // Operands are evaluated from left to right, the left value stays on the stack while the right one is computed
+        size_t left_depth = compile(*n.left);
+        size_t right_depth = compile(*n.right) + 1;
+
+        program.push_back({ n.operation, 0, 0, 0, 0.0 });
+
+        return left_depth > right_depth ? left_depth : right_depth;
+    }
+
+    void math_expr::build_lookup_table() {
+        bool has_variable = false;
+
+        for (const instruction &i : program) {
+            if (i.operation != VARIABLE) {
+                continue;
+            }
+
+            if (has_variable && i.value_index != lookup_index) {
+                return;
+            }
+
+            has_variable = true;
+            lookup_index = i.value_index;
         }
 
-        if (left) {
-            uint32_t l_count = left->get_variable_count();
-        
-            if (l_count > count) {
-                count = l_count;
+        // Constant formulas are already folded into a single raw value
+        if (!has_variable) {
+            return;
+        }
+
+        auto table = std::make_shared<std::array<float, 256>>();
+        std::vector<uint8_t> input(lookup_index + 1, 0);
+
+        for (size_t value = 0; value < table->size(); value++) {
+            input[lookup_index] = static_cast<uint8_t>(value);
+            (*table)[value] = solve(input);
+        }
+
+        lookup_table = table;
+    }
+
+    bool math_expr::detect_affine(const node &n) {
+        linear_form form;
+
+        if (!linearize(n, form) || form.stage == linear_form::CONSTANT) {
+            return false;
+        }
+
+        uint8_t first = 0xFF;
+        uint8_t last = 0;
+
+        for (uint8_t i = 0; i < 26; i++) {
+            if (form.coefficients[i] == 0.0f) {
+                continue;
             }
+
+            if (first == 0xFF) {
+                first = i;
+            }
+
+            last = i;
         }
 
-        if (right) {
-            uint32_t r_count = right->get_variable_count();
-        
-            if (r_count > count) {
-                count = r_count;
+        if (first == 0xFF || last - first + 1u > MAX_AFFINE_BYTES) {
+            return false;
+        }
+
+        uint8_t count = last - first + 1;
+        float big_endian_weight = form.coefficients[last];
+        float little_endian_weight = form.coefficients[first];
+        bool big_endian = true;
+        bool little_endian = true;
+
+        // Each byte has to weigh 256 times more than its less significant neighbour
+        for (uint8_t i = 0; i < count; i++) {
+            float weight = static_cast<float>(1u << (8 * i));
+
+            if (form.coefficients[last - i] != big_endian_weight * weight) {
+                big_endian = false;
+            }
+
+            if (form.coefficients[first + i] != little_endian_weight * weight) {
+                little_endian = false;
+            }
+        }
+
+        if (!big_endian && !little_endian) {
+            return false;
+        }
+
+        affine.first_index = first;
+        affine.byte_count = count;
+        affine.little_endian = !big_endian;
+        affine.scale = (big_endian ? big_endian_weight : little_endian_weight) * form.scale;
+        affine.bias = form.bias;
+        affine.divisor = form.divisor;
+        affine.offset = form.offset;
+
+        return true;
+    }
+
+    bool math_expr::linearize(const node &n, linear_form &form) const {
+        if (n.operation == RAW) {
+            form.bias = n.value_raw;
+            return true;
+        }
+
+        if (n.operation == VARIABLE) {
+            // Single bits can not be combined into an integer
+            if (n.value_mask != 0xFF || n.value_shift != 0 || n.value_index >= 26) {
+                return false;
+            }
+
+            form.stage = linear_form::INTEGER;
+            form.coefficients[n.value_index] = 1.0;
+            return true;
+        }
+
+        linear_form left;
+        linear_form right;
+
+        if (!linearize(*n.left, left) || !linearize(*n.right, right)) {
+            return false;
+        }
+
+        // Only shapes for which the affine form performs the exact same floating point operations as the 
+        // stack program are accepted, everything else is left to the stack program
+        bool left_constant = left.stage == linear_form::CONSTANT;
+        bool right_constant = right.stage == linear_form::CONSTANT;
+        float constant = left_constant ? left.bias : right.bias;
+        bool integral_constant = std::trunc(constant) == constant;
+
+        switch (n.operation) {
+            case ADDITION:
+            case SUBTRACTION: {
+                // Sums of integers are exact as long as they stay in the range of the mantissa
+                if (left.stage == linear_form::INTEGER && right.stage == linear_form::INTEGER) {
+                    float sign = n.operation == ADDITION ? 1.0 : -1.0;
+                    float max = std::fabs(left.bias + sign * right.bias);
+                    
+                    form = left;
+                    form.bias = left.bias + sign * right.bias;
+
+                    for (size_t i = 0; i < 26; i++) {
+                        form.coefficients[i] = left.coefficients[i] + sign * right.coefficients[i];
+                        max += std::fabs(form.coefficients[i]) * 255;
+                    }
+
+                    return max < MAX_EXACT_INTEGER;
+                }
+
+                if (left_constant == right_constant) {
+                    return false;
+                }
+
+                form = left_constant ? right : left;
+
+                // Commute constant + x and turn constant - x into -x + constant, both are exact in IEEE 754
+                if (left_constant && n.operation == SUBTRACTION) {
+                    form.negate();
+                }
+                
+                if (!left_constant && n.operation == SUBTRACTION) {
+                    constant = -constant;
+                }
+
+                if (form.stage == linear_form::INTEGER && integral_constant) {
+                    form.bias += constant;
+                    return std::fabs(form.bias) < MAX_EXACT_INTEGER;
+                }
+
+                if ((form.stage == linear_form::INTEGER || form.stage == linear_form::SCALED) && form.bias == 0.0f) {
+                    form.stage = linear_form::SCALED;
+                    form.bias = constant;
+                    return true;
+                }
+
+                if (form.stage == linear_form::DIVIDED) {
+                    form.stage = linear_form::OFFSET;
+                    form.offset = constant;
+                    return true;
+                }
+
+                return false;
+            }
+            case MULTIPLICATION: {
+                if (left_constant == right_constant) {
+                    return false;
+                }
+
+                form = left_constant ? right : left;
+
+                if (form.stage != linear_form::INTEGER) {
+                    return false;
+                }
+
+                float max = std::fabs(form.bias * constant);
+
+                if (integral_constant) {
+                    form.bias *= constant;
+
+                    for (size_t i = 0; i < 26; i++) {
+                        form.coefficients[i] *= constant;
+                        max += std::fabs(form.coefficients[i]) * 255;
+                    }
+
+                    return max < MAX_EXACT_INTEGER;
+                }
+
+                // A fractional factor is only applied once to the plain integer made of the bytes
+                for (size_t i = 0; i < 26; i++) {
+                    if (form.coefficients[i] != 0.0f && form.coefficients[i] != 1.0f 
+                        && form.coefficients[i] != 256.0f && form.coefficients[i] != 65536.0f) {
+                        return false;
+                    }
+                }
+
+                if (form.bias != 0.0f) {
+                    return false;
+                }
+
+                form.stage = linear_form::SCALED;
+                form.scale = constant;
+                return true;
             }
+            case DIVISION: {
+                // Division by zero has to keep its special result
+                if (!right_constant || right.bias == 0.0f) {
+                    return false;
+                }
+
+                if (left.stage != linear_form::INTEGER && left.stage != linear_form::SCALED) {
+                    return false;
+                }
+
+                form = left;
+                form.stage = linear_form::DIVIDED;
+                form.divisor = right.bias;
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    void math_expr::linear_form::negate() {
+        // The sign of scaled forms is carried by the scale, as their coefficients have to stay plain byte weights
+        if (stage == INTEGER) {
+            for (float &c : coefficients) {
+                c = -c;
+            }
+        }
+        else {
+            scale = -scale;
         }
 
-        return variable_count = count;
+        bias = -bias;
+        offset = -offset;
     }
 
-    void math_expr::optimize_raw() {
-        if (!left || !right) {
+    void math_expr::optimize_raw(node &n) {
+        if (!n.left || !n.right) {
             return;
         }
 
-        if (left->operation != RAW || right->operation != RAW) {
+        if (n.left->operation != RAW || n.right->operation != RAW) {
             return;
         }
         
-        value_raw = solve({});
-        operation = RAW;
+        n.value_raw = apply(n.operation, n.left->value_raw, n.right->value_raw);
+        n.operation = RAW;
 
-        left = nullptr;
-        right = nullptr;
+        n.left = nullptr;
+        n.right = nullptr;
     }
 
     size_t math_expr::find_operator(const std::string &formula) const {
@@ -239,20 +493,20 @@ namespace obd2 {
         return str.find(c, r + 1);
     }
 
-    bool math_expr::parse_raw(const std::string &formula) {
+    bool math_expr::parse_raw(node &n, const std::string &formula) {
         char *endptr = nullptr;
         float val = std::strtof(formula.c_str(), &endptr);
 
         if (*endptr == '\0' || isspace(*endptr)) {
-            operation = RAW;
-            value_raw = val;
+            n.operation = RAW;
+            n.value_raw = val;
             return true;
         }
 
         return false;
     }
 
-    bool math_expr::parse_variable(const std::string &formula) {
+    bool math_expr::parse_variable(node &n, const std::string &formula) {
         if (formula.size() > 2 || formula.size() == 0) {
             return false;
         }
@@ -261,10 +515,10 @@ namespace obd2 {
             return false;
         }
         
-        operation = VARIABLE;
-        value_index = static_cast<size_t>(tolower(formula[0]) - 'a');
-        value_mask = 0xFF;
-        value_shift = 0;
+        n.operation = VARIABLE;
+        n.value_index = static_cast<uint8_t>(tolower(formula[0]) - 'a');
+        n.value_mask = 0xFF;
+        n.value_shift = 0;
 
         if (formula.size() == 1) {
             return true;
@@ -274,8 +528,8 @@ namespace obd2 {
             return false;
         }
 
-        value_shift = static_cast<uint8_t>(formula[1]);
-        value_mask = 1 << value_shift;
+        n.value_shift = static_cast<uint8_t>(formula[1] - '0');
+        n.value_mask = 1 << n.value_shift;
 
         return true;
     }
@@ -1,13 +1,16 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <memory>
+#include <span>
 #include <string>
 #include <vector>
 
 namespace obd2 {
     class math_expr {
         private:
-            enum math_op {
+            enum math_op : uint8_t {
                 ADDITION = '+',
                 SUBTRACTION = '-',
                 MULTIPLICATION = '*',
@@ -17,36 +20,110 @@ namespace obd2 {
                 RAW
             };
 
-            math_op operation;
-            
-            std::unique_ptr<math_expr> left;
-            std::unique_ptr<math_expr> right;
-            
-            size_t value_index;
-            uint8_t value_mask;
-            uint8_t value_shift;
-            
-            float value_raw;
-
-            int32_t variable_count = -1;
-
-            void optimize_raw();
-            bool parse_raw(const std::string &formula);
-            bool parse_variable(const std::string &formula);
+            // Node of the parsed formula, only used until the formula is compiled
+            struct node {
+                math_op operation;
+
+                std::unique_ptr<node> left;
+                std::unique_ptr<node> right;
+
+                uint8_t value_index;
+                uint8_t value_mask;
+                uint8_t value_shift;
+
+                float value_raw;
+            };
+
+            // Instruction of the compiled stack program, operators pop two values and push the result
+            struct instruction {
+                math_op operation;
+                uint8_t value_index;
+                uint8_t value_mask;
+                uint8_t value_shift;
+                float value_raw;
+            };
+
+            // Formula of the form (scale * integer + bias) / divisor + offset, where the integer is made of consecutive bytes.
+            // Mirrors the order of operations of the typical PID formulas, so results equal the stack program.
+            struct affine_form {
+                uint8_t first_index;
+                uint8_t byte_count;
+                bool little_endian;
+                float scale;
+                float bias;
+                float divisor;
+                float offset;
+            };
+
+            // Linear combination of the variable bytes, only used while detecting affine formulas
+            struct linear_form {
+                // Operations applied so far, in the order the affine form evaluates them
+                enum form_stage {
+                    CONSTANT,
+                    INTEGER,
+                    SCALED,
+                    DIVIDED,
+                    OFFSET
+                };
+
+                form_stage stage = CONSTANT;
+                float coefficients[26] = {};
+                float scale = 1.0;
+                float bias = 0.0;
+                float divisor = 1.0;
+                float offset = 0.0;
+
+                void negate();
+            };
+
+            static constexpr size_t MAX_STACK_SIZE = 16;
+            static constexpr size_t MAX_AFFINE_BYTES = 3;
+            static constexpr float MAX_EXACT_INTEGER = 16777216.0;
+
+            std::vector<instruction> program;
+            uint32_t variable_count = 0;
+
+            bool is_affine = false;
+            affine_form affine;
+
+            // Results for every value of the only variable byte, shared between copies
+            std::shared_ptr<const std::array<float, 256>> lookup_table;
+            uint8_t lookup_index = 0;
+
+            std::unique_ptr<node> parse(const std::string &formula);
+            void optimize_raw(node &n);
+            bool parse_raw(node &n, const std::string &formula);
+            bool parse_variable(node &n, const std::string &formula);
             size_t find_operator(const std::string &formula) const;
             size_t find_outside(const std::string &str, char c, size_t l, size_t r) const;
             std::string strip_parentheses(const std::string &formula);
+            size_t compile(const node &n);
+            bool detect_affine(const node &n);
+            void build_lookup_table();
+            bool linearize(const node &n, linear_form &form) const;
+            float solve(const uint8_t *input_values, size_t size) const;
+
+            void solve_batch_lookup(const uint8_t *samples, size_t sample_size, size_t stride, size_t count, float *results) const;
+            void solve_batch_affine(const uint8_t *samples, size_t sample_size, size_t stride, size_t count, float *results) const;
+            void solve_batch_program(const uint8_t *samples, size_t sample_size, size_t stride, size_t count, float *results) const;
+
+            static float apply(math_op operation, float left_val, float right_val);
 
         public:
             math_expr();
             math_expr(const std::string &formula);
-            math_expr(const math_expr &e);
-            math_expr(math_expr &&e);
+            math_expr(const math_expr &e) = default;
+            math_expr(math_expr &&e) = default;
+
+            math_expr &operator=(const math_expr &e) = default;
+            math_expr &operator=(math_expr &&e) = default;
 
-            math_expr &operator=(math_expr &e);
-            math_expr &operator=(math_expr &&e);
+            float solve(const std::vector<uint8_t> &input_values) const;
+            float solve(std::span<const uint8_t> input_values) const;
 
-            float solve(const std::vector<uint8_t> &input_values);
-            uint32_t get_variable_count();
+            // Solves the formula for count samples at once, sample i starts at samples + i * stride and has sample_size bytes.
+            // The results are bit-identical to solving each sample on its own.
+            void solve_batch(const uint8_t *samples, size_t sample_size, size_t stride, size_t count, float *results) const;
+            uint32_t get_variable_count() const;
     };
-}
\ No newline at end of file
+}
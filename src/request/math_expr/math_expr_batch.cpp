@@ -0,0 +1,152 @@
+#include "math_expr.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// The kernels are written with GCC vector extensions. On x86 they are built once for AVX2 and once for the
+// SSE2 baseline, the matching version is picked at load time. FMA is deliberately not enabled, as fused
+// multiply-adds would round differently than the scalar solver.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATH_EXPR_BATCH_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define MATH_EXPR_BATCH_CLONES
+#endif
+
+#define MATH_EXPR_BATCH_LANES 8
+
+namespace obd2 {
+    typedef float batch_float __attribute__((vector_size(MATH_EXPR_BATCH_LANES * sizeof(float))));
+    typedef int32_t batch_int __attribute__((vector_size(MATH_EXPR_BATCH_LANES * sizeof(int32_t))));
+
+    void math_expr::solve_batch(const uint8_t *samples, size_t sample_size, size_t stride, size_t count, float *results) const {
+        if (lookup_table) {
+            solve_batch_lookup(samples, sample_size, stride, count, results);
+        }
+        else if (is_affine) {
+            solve_batch_affine(samples, sample_size, stride, count, results);
+        }
+        else {
+            solve_batch_program(samples, sample_size, stride, count, results);
+        }
+    }
+
+    void math_expr::solve_batch_lookup(const uint8_t *samples, size_t sample_size, size_t stride, size_t count, float *results) const {
+        const std::array<float, 256> &table = *lookup_table;
+
+        // A missing byte is solved like a zero byte
+        if (lookup_index >= sample_size) {
+            std::fill(results, results + count, table[0]);
+            return;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            results[i] = table[samples[i * stride + lookup_index]];
+        }
+    }
+
+    MATH_EXPR_BATCH_CLONES
+    void math_expr::solve_batch_affine(const uint8_t *samples, size_t sample_size, size_t stride, size_t count, float *results) const {
+        size_t i = 0;
+
+        for (; i + MATH_EXPR_BATCH_LANES <= count; i += MATH_EXPR_BATCH_LANES) {
+            batch_int raw = {};
+
+            for (uint8_t b = 0; b < affine.byte_count; b++) {
+                size_t index = affine.little_endian 
+                    ? affine.first_index + affine.byte_count - 1 - b 
+                    : affine.first_index + b;
+
+                batch_int bytes = {};
+
+                if (index < sample_size) {
+                    for (size_t lane = 0; lane < MATH_EXPR_BATCH_LANES; lane++) {
+                        bytes[lane] = samples[(i + lane) * stride + index];
+                    }
+                }
+
+                raw = (raw << 8) | bytes;
+            }
+
+            // The integer has at most 24 bits, so the conversion is exact
+            batch_float value = __builtin_convertvector(raw, batch_float) * affine.scale + affine.bias;
+
+            if (affine.divisor != 1.0f) {
+                value /= affine.divisor;
+            }
+
+            value += affine.offset;
+            std::memcpy(results + i, &value, sizeof(value));
+        }
+
+        for (; i < count; i++) {
+            results[i] = solve(samples + i * stride, sample_size);
+        }
+    }
+
+    MATH_EXPR_BATCH_CLONES
+    void math_expr::solve_batch_program(const uint8_t *samples, size_t sample_size, size_t stride, size_t count, float *results) const {
+        const batch_float infinity = batch_float{} + std::numeric_limits<float>::infinity();
+        size_t i = 0;
+
+        for (; i + MATH_EXPR_BATCH_LANES <= count; i += MATH_EXPR_BATCH_LANES) {
+            batch_float stack[MAX_STACK_SIZE];
+            size_t top = 0;
+
+            for (const instruction &instr : program) {
+                switch (instr.operation) {
+                    case VARIABLE: {
+                        batch_int values = {};
+
+                        if (instr.value_index < sample_size) {
+                            for (size_t lane = 0; lane < MATH_EXPR_BATCH_LANES; lane++) {
+                                values[lane] = (samples[(i + lane) * stride + instr.value_index] & instr.value_mask) >> instr.value_shift;
+                            }
+                        }
+
+                        stack[top++] = __builtin_convertvector(values, batch_float);
+                        break;
+                    }
+                    case RAW:
+                        stack[top++] = batch_float{} + instr.value_raw;
+                        break;
+                    case ADDITION:
+                        top--;
+                        stack[top - 1] = stack[top - 1] + stack[top];
+                        break;
+                    case SUBTRACTION:
+                        top--;
+                        stack[top - 1] = stack[top - 1] - stack[top];
+                        break;
+                    case MULTIPLICATION:
+                        top--;
+                        stack[top - 1] = stack[top - 1] * stack[top];
+                        break;
+                    case DIVISION:
+                        top--;
+                        stack[top - 1] = stack[top] == 0 ? infinity : stack[top - 1] / stack[top];
+                        break;
+                    case EXPONENTIATION:
+                        top--;
+
+                        // There is no vectorized power function, solve it lane by lane
+                        for (size_t lane = 0; lane < MATH_EXPR_BATCH_LANES; lane++) {
+                            stack[top - 1][lane] = std::pow(stack[top - 1][lane], stack[top][lane]);
+                        }
+
+                        break;
+                    default:
+                        top--;
+                        stack[top - 1] = batch_float{};
+                        break;
+                }
+            }
+
+            std::memcpy(results + i, &stack[0], sizeof(stack[0]));
+        }
+
+        for (; i < count; i++) {
+            results[i] = solve(samples + i * stride, sample_size);
+        }
+    }
+}
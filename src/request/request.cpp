@@ -7,15 +7,14 @@ namespace obd2 {
 
     request::request(uint32_t ecu_id, uint8_t service, uint16_t pid, obd2 &parent, const std::string &formula, bool refresh)
         : parent(&parent), ecu_id(ecu_id), service(service), pid(pid), formula_str(formula), formula(formula), refresh(refresh) { 
-        // TODO: Support broadcast id (0x7DF)
-        if (ecu_id < obd2::ECU_ID_FIRST || ecu_id > obd2::ECU_ID_LAST) {
+        if ((ecu_id < obd2::ECU_ID_FIRST || ecu_id > obd2::ECU_ID_LAST) && ecu_id != obd2::ECU_ID_BROADCAST) {
             throw std::invalid_argument("Invalid or unsupported ECU ID");
         }
 
         parent.add_request(*this);
     }
 
-    request::request(request &&r) {
+    request::request(request &&r) : parent(nullptr) {
         if (this == &r) {
             return;
         }
@@ -31,6 +30,7 @@ namespace obd2 {
         formula_str = r.formula_str;
         formula = r.formula;
         refresh = r.refresh;
+        refresh_ms = r.refresh_ms;
         last_value = r.last_value;
 
         r.parent = nullptr;
@@ -64,6 +64,7 @@ namespace obd2 {
         formula_str = r.formula_str;
         formula = r.formula;
         refresh = r.refresh;
+        refresh_ms = r.refresh_ms;
         last_value = r.last_value;
 
         r.parent = nullptr;
@@ -99,8 +100,23 @@ namespace obd2 {
 
         std::lock_guard<std::mutex> value_lock(value_mutex);
 
-        if (refresh || !has_value()) {
-            last_raw_value = parent->get_data(*this);
+        // Refreshed values are solved directly on the response, without copying it. The cached raw value
+        // is dropped, so it is reloaded from the last response once the request is stopped.
+        if (refresh) {
+            response_view data = parent->get_data(*this);
+            float value = data.empty() ? NO_RESPONSE : formula.solve(data.get_span());
+            last_raw_value.clear();
+
+            // The response was overwritten while it was solved, the previous value is kept instead of retrying
+            if (data.is_intact()) {
+                last_value = value;
+            }
+
+            return last_value;
+        }
+
+        if (!has_value()) {
+            load_raw_value();
         }
 
         if (last_raw_value.size() == 0) {
@@ -112,18 +128,58 @@ namespace obd2 {
         return last_value; 
     }
 
+    float request::get_value(uint32_t ecu_id) {
+        check_parent();
+
+        if (ecu_id == this->ecu_id) {
+            return get_value();
+        }
+
+        if (this->ecu_id != obd2::ECU_ID_BROADCAST) {
+            return NO_RESPONSE;
+        }
+
+        response_view data = parent->get_data(*this, ecu_id);
+        float value = data.empty() ? NO_RESPONSE : formula.solve(data.get_span());
+
+        return data.is_intact() ? value : NO_RESPONSE;
+    }
+
+    std::unordered_map<uint32_t, float> request::get_values() {
+        check_parent();
+
+        std::unordered_map<uint32_t, float> values;
+
+        if (ecu_id != obd2::ECU_ID_BROADCAST) {
+            values[ecu_id] = get_value();
+            return values;
+        }
+
+        for (uint32_t id : parent->get_responding_ecus(*this)) {
+            values[id] = get_value(id);
+        }
+
+        return values;
+    }
+
     const std::vector<uint8_t> &request::get_raw() {
         check_parent();
         
         std::lock_guard<std::mutex> value_lock(value_mutex);
 
         if (refresh || !has_value()) {
-            last_raw_value = parent->get_data(*this);
+            load_raw_value();
         }
 
         return last_raw_value;
     }
 
+    response_view request::get_raw_view() {
+        check_parent();
+
+        return parent->get_data(*this);
+    }
+
     uint32_t request::get_ecu_id() const {
         return ecu_id;    
     }
@@ -148,12 +204,64 @@ namespace obd2 {
         return refresh;
     }
 
+    void request::set_refresh_ms(uint32_t ms) {
+        check_parent();
+
+        refresh_ms = ms;
+        parent->update_refresh_ms(*this);
+    }
+
+    uint32_t request::get_refresh_ms() const {
+        return refresh_ms;
+    }
+
+    uint64_t request::get_deadline_misses() {
+        check_parent();
+
+        return parent->get_deadline_misses(*this);
+    }
+
+    uint32_t request::subscribe(const subscription_cb &cb) {
+        check_parent();
+
+        return parent->subscribe(*this, cb);
+    }
+
+    void request::unsubscribe(uint32_t id) {
+        check_parent();
+
+        parent->unsubscribe(*this, id);
+    }
+
+    void request::set_history_capacity(size_t capacity) {
+        check_parent();
+
+        parent->set_history_capacity(*this, capacity);
+    }
+
+    std::shared_ptr<const sample_history> request::get_history() {
+        check_parent();
+
+        return parent->get_history(*this);
+    }
+
     void request::check_parent() {
         if (parent == nullptr) {
             throw std::runtime_error("Request has no parent");
         }
     }
 
+    void request::load_raw_value() {
+        response_view data = parent->get_data(*this);
+
+        // Assigning keeps the capacity of the buffer, so repeated reads do not allocate
+        last_raw_value.assign(data.begin(), data.end());
+
+        if (!data.is_intact()) {
+            last_raw_value.clear();
+        }
+    }
+
     bool request::has_value() const {
         return last_raw_value.size() > 0;
     }
@@ -1,22 +1,42 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include "math_expr/math_expr.h"
+#include "../protocol/command/response_view/response_view.h"
 
 namespace obd2 {
     class obd2;
+    class req_combination;
+    class sample_history;
 
     class request {
+        public:
+            // Value decoded from a response, with the ECU that sent it and the time it arrived
+            struct sample {
+                std::chrono::steady_clock::time_point timestamp;
+                uint32_t ecu_id;
+                float value;
+            };
+
+            using subscription_cb = std::function<void(const sample &s)>;
+
         private:
             static constexpr float NO_RESPONSE = std::numeric_limits<float>::quiet_NaN();
 
             obd2 *parent;
 
+            // Combination the request is part of, set by the parent so values are read without taking its lock
+            std::atomic<std::shared_ptr<req_combination>> combination;
+
             uint32_t ecu_id;
             uint8_t service;
             uint16_t pid;
@@ -28,9 +48,11 @@ namespace obd2 {
             std::vector<uint8_t> last_raw_value;
             float last_value = NO_RESPONSE;
             bool refresh = false;
+            uint32_t refresh_ms = 0;
 
             void check_parent();
             bool has_value() const;
+            void load_raw_value();
 
         public:
             request();
@@ -47,13 +69,33 @@ namespace obd2 {
             void stop();
 
             float get_value();
+            // Value of a single ECU, only broadcast requests have values of other ECUs than their own
+            float get_value(uint32_t ecu_id);
+            // ECU ID => value of every ECU that responded
+            std::unordered_map<uint32_t, float> get_values();
             const std::vector<uint8_t> &get_raw();
+            // The span of the view is empty once the response was overwritten, data read from it is only
+            // valid if is_intact() is still true afterwards
+            response_view get_raw_view();
             uint32_t get_ecu_id() const;
             uint8_t get_service() const;
             uint16_t get_pid() const;
             std::string get_formula() const;
             size_t get_expected_size();
             bool get_refresh() const;
+            // Rate at which the value is refreshed, 0 uses the refresh rate of the parent
+            void set_refresh_ms(uint32_t ms);
+            uint32_t get_refresh_ms() const;
+            // Number of periods in which the command of the request was not answered in time
+            uint64_t get_deadline_misses();
+            // Calls cb from the dispatcher thread of the parent whenever a new response of the request arrives,
+            // returns the ID to unsubscribe with. cb must not throw and should return quickly.
+            uint32_t subscribe(const subscription_cb &cb);
+            void unsubscribe(uint32_t id);
+            // Keeps the samples of the last capacity responses, which the listener writes as they arrive. 0 disables it.
+            void set_history_capacity(size_t capacity);
+            // The history stays readable after it was disabled or the request is gone, empty if it is disabled
+            std::shared_ptr<const sample_history> get_history();
 
             friend class obd2;
     };
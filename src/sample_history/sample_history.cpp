@@ -0,0 +1,76 @@
+#include "sample_history.h"
+
+#include <stdexcept>
+
+namespace obd2 {
+    sample_history::sample_history(size_t capacity) : slots(std::make_unique<slot[]>(capacity)), capacity(capacity) {
+        if (capacity == 0) {
+            throw std::invalid_argument("History capacity must not be 0");
+        }
+    }
+
+    void sample_history::push(const request::sample &s) {
+        uint64_t position = written.load(std::memory_order_relaxed);
+        slot &target = slots[position % capacity];
+
+        // Invalidate the slot first, so readers can not take a half written sample for the old one
+        target.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        target.timestamp.store(s.timestamp.time_since_epoch().count(), std::memory_order_relaxed);
+        target.ecu_id.store(s.ecu_id, std::memory_order_relaxed);
+        target.value.store(s.value, std::memory_order_relaxed);
+
+        target.sequence.store(position + 1, std::memory_order_release);
+        written.store(position + 1, std::memory_order_release);
+    }
+
+    sample_history::cursor sample_history::get_cursor() const {
+        uint64_t end = written.load(std::memory_order_acquire);
+        return { end > capacity ? end - capacity : 0, 0 };
+    }
+
+    size_t sample_history::read(cursor &c, std::span<request::sample> out) const {
+        uint64_t end = written.load(std::memory_order_acquire);
+        size_t count = 0;
+
+        // Samples older than the capacity have been overwritten already
+        if (end > capacity && c.position < end - capacity) {
+            c.lost += end - capacity - c.position;
+            c.position = end - capacity;
+        }
+
+        while (c.position < end && count < out.size()) {
+            const slot &source = slots[c.position % capacity];
+            uint64_t sequence = source.sequence.load(std::memory_order_acquire);
+
+            request::sample s = {
+                .timestamp = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(source.timestamp.load(std::memory_order_relaxed))),
+                .ecu_id = source.ecu_id.load(std::memory_order_relaxed),
+                .value = source.value.load(std::memory_order_relaxed)
+            };
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // The writer overtook the consumer, the slot holds a newer sample or is being written
+            if (sequence != c.position + 1 || source.sequence.load(std::memory_order_relaxed) != sequence) {
+                c.lost++;
+            }
+            else {
+                out[count++] = s;
+            }
+
+            c.position++;
+        }
+
+        return count;
+    }
+
+    size_t sample_history::get_capacity() const {
+        return capacity;
+    }
+
+    uint64_t sample_history::get_written() const {
+        return written;
+    }
+}
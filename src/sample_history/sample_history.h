@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "../request/request.h"
+
+namespace obd2 {
+    // Fixed capacity ring of the latest samples of a request. Only the listener writes it, while any number of
+    // consumers read it without locking or waiting, each from its own cursor.
+    class sample_history {
+        public:
+            // Position of a consumer in the history
+            struct cursor {
+                uint64_t position = 0;
+                uint64_t lost = 0; // Samples that were overwritten before the consumer read them
+            };
+
+            sample_history(size_t capacity);
+            sample_history(const sample_history &h) = delete;
+
+            sample_history &operator=(const sample_history &h) = delete;
+
+            void push(const request::sample &s);
+            // Cursor at the oldest sample still in the history
+            cursor get_cursor() const;
+            // Copies the samples after the cursor to out and advances it, returns the number of samples copied
+            size_t read(cursor &c, std::span<request::sample> out) const;
+            size_t get_capacity() const;
+            uint64_t get_written() const;
+
+        private:
+            // Readers drop a sample if the sequence of its slot changed while they copied it
+            struct slot {
+                std::atomic<uint64_t> sequence = 0; // Position of the sample + 1, 0 while the slot is written
+                std::atomic<std::chrono::steady_clock::rep> timestamp = 0;
+                std::atomic<uint32_t> ecu_id = 0;
+                std::atomic<float> value = 0;
+            };
+
+            std::unique_ptr<slot[]> slots;
+            size_t capacity;
+            std::atomic<uint64_t> written = 0;
+    };
+}
@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "obd2.h"
+#include "sim_ecu.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        // Three ECUs with different speeds, the last one does not support the speed
+        std::vector<std::shared_ptr<sim_ecu>> speed_ecus() {
+            std::vector<std::shared_ptr<sim_ecu>> ecus = { sim_engine(0x7E0), sim_engine(0x7E1), sim_engine(0x7E2) };
+
+            ecus[0]->pids[0x0D] = { 0x32 };
+            ecus[1]->pids[0x0D] = { 0x33 };
+            ecus[2]->pids.erase(0x0D);
+
+            return ecus;
+        }
+
+        // Waits until count ECUs answered the broadcast request
+        std::unordered_map<uint32_t, float> wait_for_values(request &r, size_t count) {
+            auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            std::unordered_map<uint32_t, float> values = r.get_values();
+
+            while (values.size() < count && std::chrono::steady_clock::now() < end) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                values = r.get_values();
+            }
+
+            return values;
+        }
+    }
+
+    // A refreshed request to 0x7DF collects the answers of every ECU supporting the pid
+    TEST(broadcast_fan_out) {
+        std::vector<std::shared_ptr<sim_ecu>> ecus = speed_ecus();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler(ecus)), 10);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+        CHECK(instance.get_ecus().size() == 3);
+
+        request speed(0x7DF, 0x01, 0x0D, instance, "A", true);
+        std::unordered_map<uint32_t, float> values = wait_for_values(speed, 2);
+
+        // Give the silent ECU several refresh cycles to show up
+        uint32_t requests_before = ecus[2]->requests;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        values = speed.get_values();
+
+        REQUIRE(values.size() == 2);
+        CHECK(values.at(0x7E0) == 0x32);
+        CHECK(values.at(0x7E1) == 0x33);
+        CHECK(!values.contains(0x7E2));
+        CHECK(ecus[2]->requests > requests_before);
+
+        CHECK(speed.get_value(0x7E1) == 0x33);
+        CHECK(std::isnan(speed.get_value(0x7E2)));
+    }
+
+    // A one shot broadcast waits for the other ECUs after the first answer
+    TEST(broadcast_one_shot) {
+        std::vector<std::shared_ptr<sim_ecu>> ecus = speed_ecus();
+        ecus[1]->latency = std::chrono::milliseconds(10);
+
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler(ecus)), 1000);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        request speed(0x7DF, 0x01, 0x0D, instance, "A", false);
+        std::unordered_map<uint32_t, float> values = wait_for_values(speed, 2);
+
+        REQUIRE(values.size() == 2);
+        CHECK(values.at(0x7E0) == 0x32);
+        CHECK(values.at(0x7E1) == 0x33);
+    }
+}
@@ -0,0 +1,173 @@
+#include <atomic>
+#include <cmath>
+#include <list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "obd2.h"
+#include "sim_ecu.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        bool near(float value, float expected) {
+            return std::fabs(value - expected) < 0.01f;
+        }
+    }
+
+    TEST(six_pids_share_a_command) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 100, true);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        std::list<request> requests;
+
+        // Six single byte pids make a response of 13 bytes, which takes several frames
+        for (uint8_t pid : { 0x04, 0x05, 0x0B, 0x0D, 0x0F, 0x11 }) {
+            requests.emplace_back(engine->id, 0x01, pid, instance, "A", true);
+        }
+
+        CHECK(instance.get_transactions_per_cycle() == 1.0);
+
+        for (request &r : requests) {
+            CHECK(wait_for_value(r) == engine->pids[r.get_pid()][0]);
+        }
+
+        // A seventh pid needs another command
+        request seventh(engine->id, 0x01, 0x2F, instance, "A", true);
+        CHECK(instance.get_transactions_per_cycle() == 2.0);
+    }
+
+    TEST(multi_byte_pids_share_a_command) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 100, true);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        request rpm(engine->id, 0x01, 0x0C, instance, "(256*A+B)/4", true);
+        request maf(engine->id, 0x01, 0x10, instance, "(256*A+B)/100", true);
+        request runtime(engine->id, 0x01, 0x1F, instance, "256*A+B", true);
+        request voltage(engine->id, 0x01, 0x42, instance, "(256*A+B)/1000", true);
+        request coolant(engine->id, 0x01, 0x05, instance, "A-40", true);
+        request speed(engine->id, 0x01, 0x0D, instance, "A", true);
+
+        CHECK(instance.get_transactions_per_cycle() == 1.0);
+        CHECK(near(wait_for_value(rpm), 1726));
+        CHECK(near(wait_for_value(maf), 5));
+        CHECK(near(wait_for_value(runtime), 600));
+        CHECK(near(wait_for_value(voltage), 14.4f));
+        CHECK(near(wait_for_value(coolant), 83));
+        CHECK(near(wait_for_value(speed), 50));
+    }
+
+    TEST(slow_pid_only_joins_without_extra_frames) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 100, true);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        request rpm(engine->id, 0x01, 0x0C, instance, "(256*A+B)/4", true);
+        rpm.set_refresh_ms(10);
+
+        // The response still fits a single frame, so the slow pid rides along for free
+        request speed(engine->id, 0x01, 0x0D, instance, "A", true);
+        speed.set_refresh_ms(1000);
+        CHECK(instance.get_transactions_per_cycle() == 10.0);
+
+        // Another slow pid would make the fast response take several frames, which costs more than its own command
+        request coolant(engine->id, 0x01, 0x05, instance, "A-40", true);
+        coolant.set_refresh_ms(1000);
+        request load(engine->id, 0x01, 0x04, instance, "A*100/255", true);
+        load.set_refresh_ms(1000);
+
+        CHECK(near(static_cast<float>(instance.get_transactions_per_cycle()), 10.1f));
+        CHECK(near(wait_for_value(coolant), 83));
+        CHECK(near(wait_for_value(rpm), 1726));
+    }
+
+    TEST(values_stay_readable_while_repacking) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 100, true);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        request rpm(engine->id, 0x01, 0x0C, instance, "(256*A+B)/4", true);
+        request speed(engine->id, 0x01, 0x0D, instance, "A", true);
+        REQUIRE(near(wait_for_value(rpm), 1726));
+        REQUIRE(near(wait_for_value(speed), 50));
+
+        std::atomic<bool> running = true;
+        std::atomic<int> wrong = 0;
+        std::vector<std::thread> readers;
+
+        // Readers race the repacking below, which moves both requests between commands
+        for (int i = 0; i < 4; i++) {
+            readers.emplace_back([&]() {
+                while (running) {
+                    float r = rpm.get_value();
+                    float s = speed.get_value();
+                    rpm.get_values();
+                    rpm.get_deadline_misses();
+
+                    if ((!std::isnan(r) && !near(r, 1726)) || (!std::isnan(s) && !near(s, 50))) {
+                        wrong++;
+                    }
+                }
+            });
+        }
+
+        for (int i = 0; i < 200; i++) {
+            std::list<request> others;
+
+            for (uint8_t pid : { 0x04, 0x05, 0x0B, 0x0F, 0x11 }) {
+                others.emplace_back(engine->id, 0x01, pid, instance, "A", true);
+            }
+
+            others.front().set_refresh_ms(i % 2 ? 10 : 1000);
+        }
+
+        running = false;
+
+        for (std::thread &t : readers) {
+            t.join();
+        }
+
+        CHECK(wrong == 0);
+    }
+
+    // The listener keeps decoding the history while other pids join and leave its command
+    TEST(history_while_repacking) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 1, true);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        request rpm(engine->id, 0x01, 0x0C, instance, "(256*A+B)/4", true);
+        rpm.set_history_capacity(4096);
+
+        for (int i = 0; i < 100; i++) {
+            std::list<request> others;
+
+            // Two byte pids in front of and behind the rpm move its data within the response
+            for (uint8_t pid : { 0x10, 0x1F, 0x42 }) {
+                if ((i + pid) % 3) {
+                    others.emplace_back(engine->id, 0x01, pid, instance, "256*A+B", true);
+                }
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+
+        std::shared_ptr<const sample_history> history = rpm.get_history();
+        REQUIRE(history);
+
+        sample_history::cursor cursor = history->get_cursor();
+        std::vector<request::sample> samples(history->get_capacity());
+        size_t count = history->read(cursor, samples);
+        int wrong = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            wrong += !near(samples[i].value, 1726);
+        }
+
+        CHECK(count > 50);
+        CHECK(wrong == 0);
+    }
+}
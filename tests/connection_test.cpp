@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "obd2.h"
+#include "sim_ecu.h"
+#include "test.h"
+
+namespace obd2 {
+    TEST(vehicle_info_and_ecus) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 100);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        std::vector<ecu> ecus = instance.get_ecus();
+        REQUIRE(ecus.size() == 1);
+
+        CHECK(ecus[0].get_id() == engine->id);
+        CHECK(ecus[0].get_name() == "ECM-Engine");
+        CHECK(instance.get_vehicle_info().vin == "WVWZZZ1JZ3W386752");
+    }
+
+    // The heartbeat clears the ECUs and the vehicle info when the vehicle disconnects, copies stay usable
+    TEST(copies_outlive_disconnect) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        std::atomic<bool> online = true;
+        auto ecu_handler = sim_handler({ engine });
+
+        auto handler = [&](const loopback_transport::message &request) {
+            return online ? ecu_handler(request) : std::vector<loopback_transport::message>();
+        };
+
+        obd2 instance(std::make_unique<loopback_transport>(handler), 100);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        vehicle_info vehicle = instance.get_vehicle_info();
+        std::vector<ecu> ecus = instance.get_ecus();
+
+        online = false;
+        REQUIRE(instance.wait_for_connection_state(obd2::DISCONNECTED, 5000));
+
+        CHECK(instance.get_ecus().empty());
+        CHECK(instance.get_vehicle_info().vin.empty());
+        CHECK(vehicle.vin == "WVWZZZ1JZ3W386752");
+        REQUIRE(ecus.size() == 1);
+        CHECK(ecus[0].get_name() == "ECM-Engine");
+        CHECK(!ecus[0].get_supported_pids(0x01).empty());
+    }
+
+    // The supported pids of every ECU are discovered through the chained support ranges, as far as each chain goes
+    TEST(supported_pid_chains) {
+        std::map<uint32_t, std::vector<uint8_t>> ecu_pids = {
+            { 0x7E0, { 0x0C, 0x0D, 0x2F, 0x42, 0x5C, 0x7F } },  // Chains through 0x20, 0x40 and 0x60
+            { 0x7E1, { 0x05, 0x0C } },                          // Stops after the first range
+            { 0x7E2, { 0x0C, 0x42, 0xA6, 0xC3, 0xE1 } }         // Needs the ranges after 0xA0 as well
+        };
+
+        // The range pids themselves are reported for every range whose successor is supported
+        std::map<uint32_t, std::vector<uint8_t>> expected = {
+            { 0x7E0, { 0x0C, 0x0D, 0x20, 0x2F, 0x40, 0x42, 0x5C, 0x60, 0x7F } },
+            { 0x7E1, { 0x05, 0x0C } },
+            { 0x7E2, { 0x0C, 0x20, 0x40, 0x42, 0x60, 0x80, 0xA0, 0xA6, 0xC0, 0xC3, 0xE0, 0xE1 } }
+        };
+
+        std::vector<std::shared_ptr<sim_ecu>> sim_ecus;
+
+        for (auto &[id, pids] : ecu_pids) {
+            std::shared_ptr<sim_ecu> e = sim_engine(id);
+            e->pids.clear();
+
+            for (uint8_t pid : pids) {
+                e->pids[pid] = { 0x00 };
+            }
+
+            sim_ecus.push_back(e);
+        }
+
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler(sim_ecus)), 100);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        std::vector<ecu> ecus = instance.get_ecus();
+        REQUIRE(ecus.size() == expected.size());
+
+        for (ecu &e : ecus) {
+            std::vector<uint8_t> pids = e.get_supported_pids(0x01);
+            std::sort(pids.begin(), pids.end());
+
+            CHECK(pids == expected.at(e.get_id()));
+        }
+    }
+}
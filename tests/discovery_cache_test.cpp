@@ -0,0 +1,111 @@
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "obd2.h"
+#include "sim_ecu.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        const std::string VIN = "WVWZZZ1JZ3W386752";
+
+        // Cache file of a single test, removed when the test ends
+        struct cache_file {
+            std::string path;
+
+            cache_file(const std::string &name)
+                : path((std::filesystem::temp_directory_path() / (name + "_" + std::to_string(getpid()))).string()) {
+                std::filesystem::remove(path);
+            }
+
+            ~cache_file() {
+                std::filesystem::remove(path);
+            }
+        };
+
+        // Discovers the ECUs with the cache set before the vehicle comes online, so the first discovery uses it
+        std::vector<ecu> discover(std::shared_ptr<sim_ecu> engine, const std::string &path, vehicle_info &vehicle) {
+            std::atomic<bool> online = false;
+            auto ecu_handler = sim_handler({ engine });
+
+            auto handler = [&](const loopback_transport::message &request) {
+                return online ? ecu_handler(request) : std::vector<loopback_transport::message>();
+            };
+
+            obd2 instance(std::make_unique<loopback_transport>(handler), 100);
+            instance.set_discovery_cache(path);
+            online = true;
+
+            if (!instance.wait_for_connection_state(obd2::CONNECTED, 5000)) {
+                return std::vector<ecu>();
+            }
+
+            vehicle = instance.get_vehicle_info();
+
+            return instance.get_ecus();
+        }
+    }
+
+    TEST(cache_round_trip) {
+        cache_file cache("obd2_cache_round_trip");
+        vehicle_info vehicle;
+
+        std::vector<ecu> discovered = discover(sim_engine(), cache.path, vehicle);
+        REQUIRE(discovered.size() == 1);
+        CHECK(std::filesystem::exists(cache.path));
+
+        // The second vehicle has the same VIN but another ECU name, which is not queried once the VIN is cached
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        engine->info[0x0A] = { 0x01, 'E', 'C', 'M', '-', 'O', 't', 'h', 'e', 'r', 0x00 };
+
+        std::vector<ecu> ecus = discover(engine, cache.path, vehicle);
+        REQUIRE(ecus.size() == 1);
+
+        CHECK(vehicle.vin == VIN);
+        CHECK(ecus[0].get_name() == "ECM-Engine");
+        CHECK(ecus[0].get_supported_pids(0x01) == discovered[0].get_supported_pids(0x01));
+    }
+
+    // A vehicle whose VIN could not be read can not be found again, so it is not cached
+    TEST(cache_skips_unknown_vin) {
+        cache_file cache("obd2_cache_unknown_vin");
+        vehicle_info vehicle;
+
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        engine->info.erase(0x02);
+
+        REQUIRE(discover(engine, cache.path, vehicle).size() == 1);
+        CHECK(vehicle.vin == "Unkonwn");
+        CHECK(!std::filesystem::exists(cache.path));
+    }
+
+    // Unreadable lines are skipped, and an entry without ECUs falls back to the full discovery, which replaces it
+    TEST(corrupt_cache_file) {
+        cache_file cache("obd2_cache_corrupt");
+
+        {
+            std::ofstream file(cache.path);
+            file << "vehicle\n" << "vehicle " << VIN << " 1\n" << "ecu zz\n" << "pids 1 c d\n" << "\x01\x02 garbage\n";
+        }
+
+        vehicle_info vehicle;
+        std::vector<ecu> ecus = discover(sim_engine(), cache.path, vehicle);
+
+        REQUIRE(ecus.size() == 1);
+        CHECK(ecus[0].get_name() == "ECM-Engine");
+
+        std::unordered_map<uint32_t, ecu> cached_ecus;
+        vehicle_info cached_vehicle;
+
+        REQUIRE(discovery_cache(cache.path).load(VIN, cached_ecus, cached_vehicle));
+        CHECK(cached_ecus.size() == 1);
+        CHECK(cached_ecus.at(0x7E0).get_name() == "ECM-Engine");
+    }
+}
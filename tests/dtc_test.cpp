@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <sstream>
+
+#include "obd2.h"
+#include "sim_ecu.h"
+#include "test.h"
+
+namespace obd2 {
+    TEST(dtc_str) {
+        CHECK(dtc(0x4301, dtc::STORED).str() == "P0143");
+        CHECK(dtc(0x2341, dtc::PENDING).str() == "C0123");
+        CHECK(dtc(0xFFBF, dtc::STORED).str() == "B3FFF");
+        CHECK(dtc(0x00C0, dtc::STORED).str() == "U0000");
+        CHECK(dtc().str() == "X0000");
+    }
+
+    TEST(dtc_stream) {
+        std::stringstream ss;
+        ss << dtc(0x4301, dtc::PERMANENT);
+
+        CHECK(ss.str() == "P0143 (Permanent)");
+    }
+
+    TEST(get_dtcs) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        engine->stored_dtcs = { 0x01, 0x43, 0x00, 0x00, 0xC1, 0xA0 };
+        engine->pending_dtcs = { 0x81, 0x41 };
+
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 1000);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        std::vector<std::string> codes;
+
+        for (const dtc &d : instance.get_dtcs(engine->id)) {
+            codes.push_back(d.str());
+        }
+
+        CHECK(std::find(codes.begin(), codes.end(), "P0143") != codes.end());
+        CHECK(std::find(codes.begin(), codes.end(), "U01A0") != codes.end());
+        CHECK(std::find(codes.begin(), codes.end(), "B0141") != codes.end());
+    }
+
+    // ECUs that are not present do not answer, which must not add up to one timeout per request
+    TEST(get_dtcs_of_absent_ecu) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 1000);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        auto start = std::chrono::steady_clock::now();
+        std::unordered_map<uint32_t, std::vector<dtc>> dtcs = instance.get_dtcs({ engine->id, 0x7E1 });
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        // One timeout of 5 s, each request waiting its own would take 15 s
+        CHECK(elapsed < std::chrono::seconds(6));
+        REQUIRE(!dtcs[engine->id].empty());
+        CHECK(dtcs[engine->id][0].str() == "P0143");
+        CHECK(dtcs[0x7E1].empty());
+    }
+}
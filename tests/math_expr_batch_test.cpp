@@ -0,0 +1,80 @@
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "obd2.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        // Formulas of every evaluation path: lookup table, affine form and stack program
+        const std::vector<std::string> formulas = {
+            "A",
+            "A-40",
+            "A*100/255",
+            "(256*A+B)/4",
+            "((A*256)+B)/1000",
+            "B*256+A",
+            "(65536*A+256*B+C)/10-40",
+            "A*B/(C+1)-D^2",
+            "A7*2+A0",
+            "A/B",
+        };
+
+        // Solves count samples in one batch and one by one, true if every result has the same bits
+        bool batch_matches(const math_expr &e, const std::vector<uint8_t> &buffer, size_t sample_size, size_t stride, size_t count) {
+            std::vector<float> batch(count);
+            e.solve_batch(buffer.data(), sample_size, stride, count, batch.data());
+
+            for (size_t i = 0; i < count; i++) {
+                float scalar = e.solve(std::span<const uint8_t>(buffer.data() + i * stride, sample_size));
+
+                if (std::memcmp(&scalar, &batch[i], sizeof(float)) != 0) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+    }
+
+    TEST(math_expr_batch_bit_identical) {
+        std::mt19937 rng(1);
+        std::vector<uint8_t> buffer(16 * 10000);
+
+        for (uint8_t &b : buffer) {
+            b = static_cast<uint8_t>(rng());
+        }
+
+        // Counts that are not a multiple of the vector width leave a scalar tail
+        for (const std::string &formula : formulas) {
+            math_expr e(formula);
+
+            for (size_t count : { 0, 1, 7, 8, 33, 10000 }) {
+                CHECK(batch_matches(e, buffer, 4, 16, count));
+            }
+        }
+    }
+
+    TEST(math_expr_batch_strides) {
+        std::mt19937 rng(2);
+        std::vector<uint8_t> buffer(4 * 1000);
+
+        for (uint8_t &b : buffer) {
+            b = static_cast<uint8_t>(rng());
+        }
+
+        // Packed samples, overlapping samples and samples shorter than the formula needs
+        for (const std::string &formula : formulas) {
+            math_expr e(formula);
+
+            CHECK(batch_matches(e, buffer, 4, 4, 1000));
+            CHECK(batch_matches(e, buffer, 3, 1, 3000));
+            CHECK(batch_matches(e, buffer, 1, 4, 1000));
+            CHECK(batch_matches(e, buffer, 0, 4, 1000));
+        }
+    }
+}
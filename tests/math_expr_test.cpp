@@ -0,0 +1,92 @@
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "obd2.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        bool solves_to(const std::string &formula, const std::vector<uint8_t> &input, float expected) {
+            float value = math_expr(formula).solve(input);
+
+            return std::fabs(value - expected) <= std::fabs(expected) * 1e-6f;
+        }
+    }
+
+    TEST(math_expr_sae_formulas) {
+        CHECK(solves_to("A", { 0x1A }, 26));
+        CHECK(solves_to("A-40", { 0x7B }, 83));
+        CHECK(solves_to("A*100/255", { 0x80 }, 12800.0f / 255.0f));
+        CHECK(solves_to("(256*A+B)/4", { 0x1A, 0xF8 }, 1726));
+        CHECK(solves_to("((A*256)+B)/1000", { 0x38, 0x40 }, 14.4f));
+        CHECK(solves_to("(256*A+B)/32768*2", { 0x80, 0x00 }, 2));
+    }
+
+    TEST(math_expr_operators) {
+        CHECK(solves_to("A*B", { 3, 7 }, 21));
+        CHECK(solves_to("A^2", { 12 }, 144));
+        CHECK(solves_to("A*(A+B)", { 5, 3 }, 40));
+        CHECK(solves_to("2+3*4", {}, 14));
+        CHECK(math_expr("A/B").solve(std::vector<uint8_t>({ 1, 0 })) == std::numeric_limits<float>::infinity());
+    }
+
+    TEST(math_expr_bits) {
+        // A0 is the lowest and A7 the highest bit of A
+        CHECK(solves_to("A0", { 0x81 }, 1));
+        CHECK(solves_to("A1", { 0x81 }, 0));
+        CHECK(solves_to("A7*2+A0", { 0x81 }, 3));
+    }
+
+    TEST(math_expr_missing_bytes) {
+        // Missing bytes are solved as zero, on every evaluation path
+        CHECK(solves_to("(256*A+B)/4", { 0x1A }, 1664));
+        CHECK(solves_to("A-40", {}, -40));
+        CHECK(solves_to("A*B+C", { 2, 3 }, 6));
+        CHECK(solves_to("", { 0x10 }, 0));
+    }
+
+    TEST(math_expr_copy) {
+        math_expr e("A*(A-B)");
+        math_expr copy = e;
+        math_expr moved = std::move(e);
+
+        CHECK(copy.solve(std::vector<uint8_t>({ 9, 4 })) == 45);
+        CHECK(moved.solve(std::vector<uint8_t>({ 9, 4 })) == 45);
+        CHECK(copy.get_variable_count() == 2);
+    }
+
+    TEST(math_expr_invalid) {
+        bool threw = false;
+
+        try {
+            math_expr e("A+#");
+        }
+        catch (const std::invalid_argument &) {
+            threw = true;
+        }
+
+        CHECK(threw);
+
+        // Every nesting level needs a slot of the fixed stack
+        std::string deep = "A";
+
+        for (int i = 0; i < 20; i++) {
+            deep = "A+(" + deep + ")";
+        }
+
+        threw = false;
+
+        try {
+            math_expr e(deep);
+        }
+        catch (const std::invalid_argument &) {
+            threw = true;
+        }
+
+        CHECK(threw);
+    }
+}
@@ -0,0 +1,261 @@
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "obd2.h"
+#include "sim_ecu.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        std::chrono::microseconds cpu_time() {
+            timespec ts;
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+            return std::chrono::seconds(ts.tv_sec) + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(ts.tv_nsec));
+        }
+    }
+
+    TEST(listener_idle) {
+        protocol p(std::make_unique<loopback_transport>(echo_handler), 1000);
+        command c(0x7E0, 0x7E8, 0x01, 0x0C, p, true);
+        REQUIRE(c.wait_for_response(1000) == cmd_status::OK);
+
+        // The listener only wakes up for the refresh tick, so it must not use any noticeable CPU time
+        std::chrono::microseconds start = cpu_time();
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+        CHECK(cpu_time() - start < std::chrono::milliseconds(20));
+    }
+
+    // One shot commands of several threads are answered while cyclic commands keep the listener busy
+    TEST(listener_under_load) {
+        // The response of a command is cleared when it times out, so the responses are counted as they arrive
+        std::vector<std::atomic<int>> responses(32);
+
+        protocol p(std::make_unique<loopback_transport>(echo_handler), 1);
+        std::list<command> cyclic;
+
+        for (uint16_t i = 0; i < 32; i++) {
+            uint32_t tx_id = 0x7E0 + i % 8;
+            command &c = cyclic.emplace_back(tx_id, tx_id + 0x08, 0x01, static_cast<uint16_t>(1 + i / 8), p, true);
+            c.set_response_cb([&responses, i](uint32_t, uint64_t, std::chrono::steady_clock::time_point) { responses[i]++; });
+        }
+
+        std::atomic<int> failed = 0;
+        std::vector<std::thread> threads;
+
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < 200; i++) {
+                    uint32_t tx_id = 0x7E0 + (t + i) % 8;
+                    uint16_t pid = 0x40 + t;
+                    command c(tx_id, tx_id + 0x08, 0x09, pid, p);
+
+                    std::vector<uint8_t> expected = { static_cast<uint8_t>(pid), 0x00 };
+
+                    if (c.wait_for_response(1000) != cmd_status::OK || c.get_buffer() != expected) {
+                        failed++;
+                    }
+                }
+            });
+        }
+
+        for (std::thread &t : threads) {
+            t.join();
+        }
+
+        // The one shot commands may be done within a few refresh periods, so the cyclic ones get some more time
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        CHECK(failed == 0);
+
+        for (std::atomic<int> &n : responses) {
+            CHECK(n > 10);
+        }
+    }
+
+    // The listener completes a one shot command with its response, waiting for it afterwards returns its status
+    TEST(wait_for_completed_one_shot) {
+        protocol p(std::make_unique<loopback_transport>(echo_handler), 1000);
+        std::atomic<int> failed = 0;
+        std::vector<std::thread> threads;
+
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < 500; i++) {
+                    command c(0x7E0 + t, 0x7E8 + t, 0x09, 0x02, p);
+
+                    // Every other command is most likely completed before the wait starts
+                    if (i % 2) {
+                        std::this_thread::yield();
+                    }
+
+                    try {
+                        if (c.wait_for_response(1000) != cmd_status::OK) {
+                            failed++;
+                        }
+                    }
+                    catch (const std::exception &) {
+                        failed++;
+                    }
+                }
+            });
+        }
+
+        for (std::thread &t : threads) {
+            t.join();
+        }
+
+        CHECK(failed == 0);
+    }
+
+    // A transport that blocks while sending for the listener does not hold up other threads adding commands
+    TEST(slow_send_does_not_block_commands) {
+        auto handler = [](const loopback_transport::message &request) {
+            if (request.id == 0x7E0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+
+            return echo_handler(request);
+        };
+
+        protocol p(std::make_unique<loopback_transport>(handler), 1);
+        command slow(0x7E0, 0x7E8, 0x01, 0x0C, p, true);
+        REQUIRE(slow.wait_for_response(1000) == cmd_status::OK);
+
+        // The responses are still read by the listener, so only adding and sending the commands is timed
+        for (int i = 0; i < 10; i++) {
+            auto start = std::chrono::steady_clock::now();
+            command c(0x7E1, 0x7E9, 0x09, 0x02, p);
+
+            CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50));
+            CHECK(c.wait_for_response(1000) == cmd_status::OK);
+        }
+    }
+
+    // A thread blocked sending its one shot command does not hold up other threads creating commands
+    TEST(slow_one_shot_does_not_block_commands) {
+        auto handler = [](const loopback_transport::message &request) {
+            if (request.id == 0x7E0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+
+            return echo_handler(request);
+        };
+
+        protocol p(std::make_unique<loopback_transport>(handler), 1000);
+        std::atomic<bool> sending = false;
+
+        std::thread slow([&] {
+            sending = true;
+            command c(0x7E0, 0x7E8, 0x09, 0x02, p);
+        });
+
+        while (!sending) {
+            std::this_thread::yield();
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        auto start = std::chrono::steady_clock::now();
+        command c(0x7E1, 0x7E9, 0x09, 0x02, p);
+
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+        CHECK(c.wait_for_response(1000) == cmd_status::OK);
+
+        slow.join();
+    }
+
+    // Commands to different ECUs are in flight at the same time, so the ECU count does not lower the rate of each
+    TEST(pipelining_across_ecus) {
+        std::vector<std::shared_ptr<sim_ecu>> ecus;
+
+        for (uint32_t id = 0x7E0; id <= 0x7E7; id++) {
+            ecus.push_back(sim_engine(id));
+            ecus.back()->latency = std::chrono::milliseconds(5);
+        }
+
+        protocol p(std::make_unique<loopback_transport>(sim_handler(ecus)), 5);
+        std::list<command> commands;
+
+        for (std::shared_ptr<sim_ecu> &e : ecus) {
+            commands.emplace_back(e->id, e->id + 0x08, 0x01, 0x0D, p, true);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+        uint64_t responses = 0;
+
+        for (command &c : commands) {
+            CHECK(c.get_buffer() == std::vector<uint8_t>({ 0x0D, 0x32 }));
+            responses += c.get_view().get_generation();
+        }
+
+        // One command at a time would allow at most 100 round trips of 5 ms
+        CHECK(responses > 300);
+    }
+
+    // Lost responses only stall the socket for the learned timeout instead of the ceiling
+    TEST(lossy_ecu) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        engine->latency = std::chrono::milliseconds(2);
+        engine->drop_every = 3;
+
+        protocol p(std::make_unique<loopback_transport>(sim_handler({ engine })), 10);
+        p.set_response_timeout(10, 1000);
+
+        // The response of a command is cleared when it times out, so the responses are counted as they arrive
+        std::atomic<int> responses = 0;
+
+        command c(engine->id, engine->id + 0x08, 0x01, 0x0D, p, true);
+        c.set_response_cb([&](uint32_t, uint64_t, std::chrono::steady_clock::time_point) { responses++; });
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        rtt_estimator rtt = p.get_rtt(engine->id, engine->id + 0x08);
+
+        // Each loss would cost a whole second with a fixed timeout
+        CHECK(responses > 20);
+        CHECK(rtt.get_timeout_count() > 5);
+        CHECK(rtt.get_srtt() >= std::chrono::milliseconds(2));
+        CHECK(rtt.get_srtt() < std::chrono::milliseconds(10));
+    }
+
+    // Cyclic commands of one ECU with mixed periods share the socket by deadline, each at its own rate
+    TEST(mixed_refresh_periods) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        protocol p(std::make_unique<loopback_transport>(sim_handler({ engine })), 1000);
+
+        const std::vector<std::pair<uint16_t, uint32_t>> periods = { { 0x0C, 10 }, { 0x0D, 100 }, { 0x05, 1000 } };
+        std::vector<std::atomic<int>> responses(periods.size());
+        std::list<command> commands;
+
+        for (size_t i = 0; i < periods.size(); i++) {
+            command &c = commands.emplace_back(engine->id, engine->id + 0x08, 0x01, periods[i].first, p, true);
+            c.set_refresh_ms(periods[i].second);
+            c.set_response_cb([&responses, i](uint32_t, uint64_t, std::chrono::steady_clock::time_point) { responses[i]++; });
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        for (std::atomic<int> &r : responses) {
+            r = 0;
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        CHECK(responses[0] >= 90 && responses[0] <= 102);
+        CHECK(responses[1] >= 9 && responses[1] <= 11);
+        CHECK(responses[2] <= 1);
+
+        for (command &c : commands) {
+            CHECK(c.get_deadline_misses() == 0);
+        }
+    }
+}
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "obd2.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        // Writes the slot the way the listener does
+        void write_slot(response_slot &slot, const std::vector<uint8_t> &data, uint64_t generation) {
+            uint64_t sequence = slot.sequence.load();
+
+            slot.sequence = sequence + 1;
+            std::copy(data.begin(), data.end(), slot.data.begin());
+            slot.size = data.size();
+            slot.generation = generation;
+            slot.sequence = sequence + 2;
+        }
+    }
+
+    TEST(view_of_slot) {
+        response_slot slot;
+        write_slot(slot, { 0x0C, 0x1A, 0xF8 }, 1);
+
+        response_view v(slot);
+
+        CHECK(v.is_intact());
+        CHECK(v.get_generation() == 1);
+        CHECK(v.to_vector() == std::vector<uint8_t>({ 0x0C, 0x1A, 0xF8 }));
+        CHECK(v.subview(1).to_vector() == std::vector<uint8_t>({ 0x1A, 0xF8 }));
+        CHECK(v.subview(3).empty());
+        CHECK(v.get_span().size() == 3);
+    }
+
+    TEST(view_of_slot_being_written) {
+        response_slot slot;
+        write_slot(slot, { 0x0C, 0x1A, 0xF8 }, 1);
+        slot.sequence++;
+
+        CHECK(response_view(slot).empty());
+    }
+
+    TEST(overwritten_view_is_not_intact) {
+        response_slot slot;
+        write_slot(slot, { 0x0D, 0x32 }, 1);
+
+        response_view v(slot);
+        response_view sub = v.subview(1);
+        write_slot(slot, { 0x0D, 0x33 }, 5);
+
+        // The data of the view is still readable, but it belongs to another response
+        CHECK(!v.is_intact());
+        CHECK(!sub.is_intact());
+        CHECK(v.to_vector().empty());
+        CHECK(v.get_span().empty());
+        CHECK(sub.get_span().empty());
+        CHECK(v.get_generation() == 1);
+        CHECK(response_view(slot).get_generation() == 5);
+    }
+
+    // Readers never see a mix of two responses without noticing it
+    TEST(many_readers) {
+        std::atomic<uint8_t> counter = 0;
+
+        // Every byte of a response holds the same value, which changes with each response
+        auto handler = [&counter](const loopback_transport::message &request) {
+            std::vector<uint8_t> response = { static_cast<uint8_t>(request.data[0] + 0x40), request.data[1] };
+            response.resize(200, counter++);
+
+            return std::vector<loopback_transport::message>({ { request.id + 0x08, response } });
+        };
+
+        protocol p(std::make_unique<loopback_transport>(handler), 0);
+        command c(0x7E0, 0x7E8, 0x01, 0x0C, p, true);
+        REQUIRE(c.wait_for_response(1000) == cmd_status::OK);
+
+        std::atomic<bool> running = true;
+        std::atomic<uint64_t> intact = 0;
+        std::atomic<uint64_t> mixed = 0;
+        std::atomic<uint64_t> backwards = 0;
+        std::vector<std::thread> readers;
+
+        for (int i = 0; i < 8; i++) {
+            readers.emplace_back([&]() {
+                uint64_t last_generation = 0;
+
+                while (running) {
+                    response_view v = c.get_view();
+
+                    if (v.empty()) {
+                        continue;
+                    }
+
+                    bool same = std::all_of(v.begin() + 1, v.end(), [&v](uint8_t b) { return b == v[1]; });
+
+                    if (!v.is_intact()) {
+                        continue;
+                    }
+
+                    intact++;
+                    mixed += !same;
+                    backwards += v.get_generation() < last_generation;
+                    last_generation = v.get_generation();
+                }
+            });
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        running = false;
+
+        for (std::thread &t : readers) {
+            t.join();
+        }
+
+        CHECK(c.get_view().get_generation() > 100);
+        CHECK(intact > 1000);
+        CHECK(mixed == 0);
+        CHECK(backwards == 0);
+    }
+}
@@ -0,0 +1,82 @@
+#include <chrono>
+
+#include "obd2.h"
+#include "test.h"
+
+using namespace std::chrono_literals;
+
+namespace obd2 {
+    TEST(rtt_without_samples) {
+        rtt_estimator rtt;
+
+        // Nothing is known about the ECU, so the whole ceiling is waited
+        CHECK(rtt.get_timeout(50ms, 1000ms) == 1000ms);
+        CHECK(rtt.get_sample_count() == 0);
+    }
+
+    TEST(rtt_first_sample) {
+        rtt_estimator rtt;
+        rtt.add_sample(10ms);
+
+        CHECK(rtt.get_srtt() == 10ms);
+        CHECK(rtt.get_rttvar() == 5ms);
+        CHECK(rtt.get_timeout(1ms, 1000ms) == 30ms);
+    }
+
+    TEST(rtt_smoothing) {
+        rtt_estimator rtt;
+        rtt.add_sample(10ms);
+        rtt.add_sample(20ms);
+
+        // RTTVAR = 3/4 * 5 ms + 1/4 * |10 ms - 20 ms|, SRTT = 7/8 * 10 ms + 1/8 * 20 ms
+        CHECK(rtt.get_rttvar() == 6250us);
+        CHECK(rtt.get_srtt() == 11250us);
+        CHECK(rtt.get_timeout(1ms, 1000ms) == 36250us);
+        CHECK(rtt.get_sample_count() == 2);
+    }
+
+    TEST(rtt_converges) {
+        rtt_estimator rtt;
+
+        for (int i = 0; i < 100; i++) {
+            rtt.add_sample(4ms);
+        }
+
+        CHECK(rtt.get_srtt() == 4ms);
+        CHECK(rtt.get_rttvar() < 100us);
+    }
+
+    TEST(rtt_bounds) {
+        rtt_estimator rtt;
+        rtt.add_sample(10ms);
+
+        CHECK(rtt.get_timeout(50ms, 1000ms) == 50ms);
+        CHECK(rtt.get_timeout(1ms, 20ms) == 20ms);
+
+        // A floor above the ceiling wins
+        CHECK(rtt.get_timeout(50ms, 20ms) == 50ms);
+    }
+
+    TEST(rtt_backoff) {
+        rtt_estimator rtt;
+        rtt.add_sample(10ms);
+
+        rtt.add_timeout();
+        CHECK(rtt.get_timeout(1ms, 10s) == 60ms);
+
+        rtt.add_timeout();
+        CHECK(rtt.get_timeout(1ms, 10s) == 120ms);
+
+        // The backoff is capped at 64 times the timeout
+        for (int i = 0; i < 10; i++) {
+            rtt.add_timeout();
+        }
+
+        CHECK(rtt.get_timeout(1ms, 10s) == 64 * 30ms);
+        CHECK(rtt.get_timeout_count() == 12);
+
+        // A response resets the backoff
+        rtt.add_sample(10ms);
+        CHECK(rtt.get_timeout(1ms, 10s) < 60ms);
+    }
+}
@@ -0,0 +1,166 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "obd2.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        // Every field of a sample is derived from its position, so a sample mixed from two pushes is detected
+        request::sample make_sample(uint64_t position) {
+            return {
+                .timestamp = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(position)),
+                .ecu_id = static_cast<uint32_t>(position),
+                .value = static_cast<float>(position % 1000000)
+            };
+        }
+
+        bool consistent(const request::sample &s) {
+            uint64_t position = s.timestamp.time_since_epoch().count();
+            return s.ecu_id == static_cast<uint32_t>(position) && s.value == static_cast<float>(position % 1000000);
+        }
+    }
+
+    TEST(read_in_order) {
+        sample_history h(8);
+
+        for (uint64_t i = 0; i < 5; i++) {
+            h.push(make_sample(i));
+        }
+
+        sample_history::cursor c = h.get_cursor();
+        std::vector<request::sample> out(8);
+
+        REQUIRE(h.read(c, out) == 5);
+
+        for (uint64_t i = 0; i < 5; i++) {
+            CHECK(out[i].ecu_id == i);
+        }
+
+        CHECK(c.position == 5);
+        CHECK(c.lost == 0);
+        CHECK(h.read(c, out) == 0);
+    }
+
+    TEST(overwritten_samples_are_lost) {
+        sample_history h(8);
+        sample_history::cursor c = h.get_cursor();
+
+        for (uint64_t i = 0; i < 20; i++) {
+            h.push(make_sample(i));
+        }
+
+        std::vector<request::sample> out(4);
+
+        // The consumer is behind by more than the capacity, so the first 12 samples are gone
+        REQUIRE(h.read(c, out) == 4);
+        CHECK(out[0].ecu_id == 12);
+        CHECK(c.lost == 12);
+
+        REQUIRE(h.read(c, out) == 4);
+        CHECK(out[3].ecu_id == 19);
+        CHECK(c.lost + 8 == h.get_written());
+
+        // A new cursor starts at the oldest sample still in the history
+        CHECK(h.get_cursor().position == 12);
+    }
+
+    // Readers racing the writer either get an intact sample or count it as lost, every position is accounted for
+    TEST(concurrent_readers) {
+        sample_history h(16);
+        std::atomic<bool> running = true;
+        std::atomic<uint64_t> mixed = 0;
+        std::atomic<uint64_t> unordered = 0;
+        std::atomic<uint64_t> unaccounted = 0;
+        std::atomic<uint64_t> lost = 0;
+        std::vector<std::thread> readers;
+
+        for (int i = 0; i < 4; i++) {
+            readers.emplace_back([&]() {
+                sample_history::cursor c = h.get_cursor();
+                uint64_t start = c.position;
+                uint64_t read = 0;
+                uint64_t last = 0;
+                std::vector<request::sample> out(4);
+
+                while (running || c.position < h.get_written()) {
+                    size_t count = h.read(c, out);
+
+                    for (size_t j = 0; j < count; j++) {
+                        uint64_t position = out[j].timestamp.time_since_epoch().count();
+
+                        mixed += !consistent(out[j]);
+                        unordered += read > 0 && position <= last;
+                        last = position;
+                    }
+
+                    read += count;
+                }
+
+                unaccounted += c.position - start - read - c.lost;
+                lost += c.lost;
+            });
+        }
+
+        for (uint64_t i = 0; i < 2000000; i++) {
+            h.push(make_sample(i));
+        }
+
+        running = false;
+
+        for (std::thread &t : readers) {
+            t.join();
+        }
+
+        CHECK(mixed == 0);
+        CHECK(unordered == 0);
+        CHECK(unaccounted == 0);
+        // The writer does not wait for the readers, so some of them fall behind
+        CHECK(lost > 0);
+    }
+
+    // With a single slot every read races the writer, which must never hand out a sample mixed from two pushes
+    TEST(torn_reads_are_detected) {
+        sample_history h(1);
+        std::atomic<bool> running = true;
+        std::atomic<uint64_t> mixed = 0;
+        std::atomic<uint64_t> intact = 0;
+        std::atomic<uint64_t> torn = 0;
+        std::vector<std::thread> readers;
+
+        for (int i = 0; i < 4; i++) {
+            readers.emplace_back([&]() {
+                std::vector<request::sample> out(1);
+
+                while (running) {
+                    sample_history::cursor c = h.get_cursor();
+
+                    // A sample of a later push than the position the cursor read counts as mixed as well
+                    if (h.read(c, out) == 1) {
+                        mixed += !consistent(out[0]) || out[0].ecu_id != static_cast<uint32_t>(c.position - 1);
+                        intact++;
+                    }
+                    else {
+                        torn += c.lost;
+                    }
+                }
+            });
+        }
+
+        for (uint64_t i = 0; i < 5000000; i++) {
+            h.push(make_sample(i));
+        }
+
+        running = false;
+
+        for (std::thread &t : readers) {
+            t.join();
+        }
+
+        CHECK(mixed == 0);
+        CHECK(intact > 0);
+        CHECK(torn > 0);
+    }
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "obd2.h"
+
+namespace obd2 {
+    // Software ECU for the loopback transport, answers the OBD2 services used by the library.
+    // The data must not be changed while the ECU is attached to a running transport.
+    struct sim_ecu {
+        uint32_t id = 0x7E0; // Physical request ID, responses are sent to id + 8
+        std::map<uint8_t, std::vector<uint8_t>> pids; // Service 01 PID => data
+        std::map<uint8_t, std::vector<uint8_t>> info; // Service 09 PID => data
+        std::vector<uint8_t> stored_dtcs;
+        std::vector<uint8_t> pending_dtcs;
+        std::vector<uint8_t> permanent_dtcs;
+        std::chrono::microseconds latency = std::chrono::microseconds(0); // Time until a response arrives
+        uint32_t drop_every = 0; // Every nth request is not answered, 0 answers all
+        std::atomic<uint32_t> requests = 0;
+
+        // Bitmap of the supported PIDs following base, with the last bit set if any later PID is supported
+        static std::vector<uint8_t> support_bitmap(const std::map<uint8_t, std::vector<uint8_t>> &data, uint8_t base) {
+            std::vector<uint8_t> bitmap(4, 0);
+
+            for (auto &[pid, value] : data) {
+                if (pid > base && pid <= base + 0x20) {
+                    uint8_t bit = pid - base - 1;
+                    bitmap[bit / 8] |= 0x80 >> (bit % 8);
+                }
+
+                if (pid > base + 0x20) {
+                    bitmap[3] |= 0x01;
+                }
+            }
+
+            return bitmap;
+        }
+
+        // Response to the request, empty if the ECU stays silent
+        std::vector<uint8_t> respond(const std::vector<uint8_t> &request) {
+            uint32_t n = ++requests;
+
+            if (drop_every && n % drop_every == 0) {
+                return {};
+            }
+
+            uint8_t sid = request[0];
+            std::vector<uint8_t> response = { static_cast<uint8_t>(sid + 0x40) };
+
+            if (sid == 0x01 || sid == 0x09) {
+                std::map<uint8_t, std::vector<uint8_t>> &data = sid == 0x01 ? pids : info;
+
+                for (size_t i = 1; i < request.size(); i++) {
+                    uint8_t pid = request[i];
+                    std::vector<uint8_t> value;
+
+                    if (pid % 0x20 == 0) {
+                        value = support_bitmap(data, pid);
+
+                        // Only the first range is always answered
+                        if (pid != 0 && value == std::vector<uint8_t>(4, 0)) {
+                            continue;
+                        }
+                    }
+                    else if (auto it = data.find(pid); it != data.end()) {
+                        value = it->second;
+                    }
+                    else {
+                        continue;
+                    }
+
+                    response.push_back(pid);
+                    response.insert(response.end(), value.begin(), value.end());
+                }
+
+                // Request out of range
+                if (response.size() == 1) {
+                    return { 0x7F, sid, 0x31 };
+                }
+
+                return response;
+            }
+
+            if (sid == 0x03 || sid == 0x07 || sid == 0x0A) {
+                std::vector<uint8_t> &dtcs = sid == 0x03 ? stored_dtcs : sid == 0x07 ? pending_dtcs : permanent_dtcs;
+
+                // The DTCs directly follow the service, without a count
+                response.insert(response.end(), dtcs.begin(), dtcs.end());
+
+                return response;
+            }
+
+            if (sid == 0x04) {
+                return response;
+            }
+
+            // Service not supported
+            return { 0x7F, sid, 0x11 };
+        }
+    };
+
+    // Passes every message to the ECUs it is addressed to, like a vehicle with those ECUs would
+    inline loopback_transport::ecu_handler sim_handler(std::vector<std::shared_ptr<sim_ecu>> ecus) {
+        return [ecus](const loopback_transport::message &request) {
+            std::vector<loopback_transport::message> responses;
+
+            for (const std::shared_ptr<sim_ecu> &e : ecus) {
+                if (request.id != e->id && request.id != 0x7DF) {
+                    continue;
+                }
+
+                std::vector<uint8_t> response = e->respond(request.data);
+
+                // ECUs stay silent on broadcasts they do not support
+                if (response.empty() || (request.id == 0x7DF && response[0] == 0x7F)) {
+                    continue;
+                }
+
+                responses.push_back({ e->id + 0x08, std::move(response), e->latency });
+            }
+
+            return responses;
+        };
+    }
+
+    // Answers every request to any ECU with the requested PIDs followed by one data byte each
+    inline std::vector<loopback_transport::message> echo_handler(const loopback_transport::message &request) {
+        std::vector<uint8_t> response = { static_cast<uint8_t>(request.data[0] + 0x40) };
+
+        for (size_t i = 1; i < request.data.size(); i++) {
+            response.push_back(request.data[i]);
+            response.push_back(0x00);
+        }
+
+        return { { request.id + 0x08, response } };
+    }
+
+    // Engine ECU with a VIN, some live data and DTCs
+    inline std::shared_ptr<sim_ecu> sim_engine(uint32_t id = 0x7E0) {
+        auto e = std::make_shared<sim_ecu>();
+
+        e->id = id;
+        e->pids[0x04] = { 0x33 };               // Engine load 20%
+        e->pids[0x05] = { 0x7B };               // Coolant temperature 83 C
+        e->pids[0x0B] = { 0x64 };               // Intake manifold pressure 100 kPa
+        e->pids[0x0C] = { 0x1A, 0xF8 };         // RPM 1726
+        e->pids[0x0D] = { 0x32 };               // Speed 50 km/h
+        e->pids[0x0F] = { 0x41 };               // Intake air temperature 25 C
+        e->pids[0x10] = { 0x01, 0xF4 };         // MAF 5 g/s
+        e->pids[0x11] = { 0x80 };               // Throttle 50%
+        e->pids[0x1F] = { 0x02, 0x58 };         // Run time 600 s
+        e->pids[0x2F] = { 0x40 };               // Fuel level 25%
+        e->pids[0x42] = { 0x38, 0x40 };         // Control module voltage 14.4 V
+        e->pids[0x46] = { 0x30 };               // Ambient air temperature 8 C
+        e->info[0x02] = { 0x01, 'W', 'V', 'W', 'Z', 'Z', 'Z', '1', 'J', 'Z', '3', 'W', '3', '8', '6', '7', '5', '2' };
+        e->info[0x0A] = { 0x01, 'E', 'C', 'M', '-', 'E', 'n', 'g', 'i', 'n', 'e', 0x00 };
+        e->stored_dtcs = { 0x01, 0x43, 0x00, 0x00 };
+        e->pending_dtcs = { 0x41, 0x23 };
+
+        return e;
+    }
+
+    // Waits for the first value of a refreshed request, NaN if none arrived in time
+    inline float wait_for_value(request &r, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+        auto end = std::chrono::steady_clock::now() + timeout;
+        float value = r.get_value();
+
+        while (std::isnan(value) && std::chrono::steady_clock::now() < end) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            value = r.get_value();
+        }
+
+        return value;
+    }
+}
@@ -0,0 +1,151 @@
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "obd2.h"
+#include "sim_ecu.h"
+#include "test.h"
+
+namespace obd2 {
+    namespace {
+        // Holds up the dispatcher in the first call of a subscription until it is released
+        struct blocker {
+            std::atomic<bool> blocking = false;
+            std::atomic<bool> released = false;
+
+            void wait() {
+                if (blocking.exchange(true)) {
+                    return;
+                }
+
+                while (!released) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+
+            void wait_until_blocking() {
+                while (!blocking) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        };
+    }
+
+    TEST(subscription_delivers_values) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 10);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        std::mutex samples_mutex;
+        std::vector<request::sample> samples;
+
+        request rpm(engine->id, 0x01, 0x0C, instance, "(256*A+B)/4", true);
+        uint32_t id = rpm.subscribe([&](const request::sample &s) {
+            std::lock_guard<std::mutex> samples_lock(samples_mutex);
+            samples.push_back(s);
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        rpm.unsubscribe(id);
+
+        std::lock_guard<std::mutex> samples_lock(samples_mutex);
+        CHECK(samples.size() > 10);
+
+        for (size_t i = 0; i < samples.size(); i++) {
+            CHECK(samples[i].value == 1726);
+            CHECK(samples[i].ecu_id == engine->id);
+            CHECK(i == 0 || samples[i].timestamp > samples[i - 1].timestamp);
+        }
+
+        // Nothing is delivered after unsubscribing
+        size_t delivered = samples.size();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CHECK(samples.size() == delivered);
+        CHECK(instance.get_dropped_notifications() == 0);
+    }
+
+    // A consumer that does not keep up loses the oldest notifications, not the newest
+    TEST(full_queue_drops_oldest) {
+        std::vector<std::shared_ptr<sim_ecu>> ecus;
+
+        for (uint32_t id = 0x7E0; id < 0x7E4; id++) {
+            ecus.push_back(sim_engine(id));
+        }
+
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler(ecus)), 1);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        blocker b;
+        std::mutex received_mutex;
+        std::vector<std::chrono::steady_clock::time_point> received;
+        std::list<request> requests;
+
+        for (std::shared_ptr<sim_ecu> &e : ecus) {
+            request &r = requests.emplace_back(e->id, 0x01, 0x0D, instance, "A", true);
+
+            r.subscribe([&](const request::sample &s) {
+                b.wait();
+
+                std::lock_guard<std::mutex> received_lock(received_mutex);
+                received.push_back(s.timestamp);
+            });
+        }
+
+        b.wait_until_blocking();
+        auto blocked_at = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        // The queue holds far fewer notifications than arrived while the dispatcher was blocked
+        CHECK(instance.get_dropped_notifications() > 0);
+
+        for (request &r : requests) {
+            r.stop();
+        }
+
+        b.released = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        std::lock_guard<std::mutex> received_lock(received_mutex);
+        REQUIRE(received.size() > 2);
+
+        // The first entry is the blocked notification, the next one is the oldest that was kept
+        CHECK(received[1] > blocked_at + std::chrono::milliseconds(200));
+    }
+
+    // Queued notifications of responses that a newer response replaced are skipped by the dispatcher
+    TEST(stale_notifications_are_skipped) {
+        std::shared_ptr<sim_ecu> engine = sim_engine();
+        obd2 instance(std::make_unique<loopback_transport>(sim_handler({ engine })), 1);
+        REQUIRE(instance.wait_for_connection_state(obd2::CONNECTED, 5000));
+
+        blocker b;
+        std::atomic<int> delivered = 0;
+
+        request speed(engine->id, 0x01, 0x0D, instance, "A", true);
+        speed.subscribe([&](const request::sample &) {
+            b.wait();
+            delivered++;
+        });
+
+        b.wait_until_blocking();
+        uint32_t requests_before = engine->requests;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        // Stopping the request leaves the notifications of the last responses in the queue
+        speed.stop();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint32_t queued = engine->requests - requests_before;
+
+        b.released = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        // Only the blocked notification and the one of the latest response are delivered
+        CHECK(queued > 10);
+        CHECK(instance.get_dropped_notifications() == 0);
+        CHECK(delivered <= 2);
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal test harness, every test executable links test_main.cpp which runs the registered tests.
+// Failed checks are reported and counted, the test continues after them.
+namespace obd2::test {
+    struct test_case {
+        const char *name;
+        std::function<void(void)> fn;
+    };
+
+    std::vector<test_case> &registry();
+    void fail(const char *expr, const char *file, int line);
+
+    struct registrar {
+        registrar(const char *name, std::function<void(void)> fn) {
+            registry().push_back({ name, std::move(fn) });
+        }
+    };
+}
+
+#define OBD2_TEST_CONCAT_(a, b) a##b
+#define OBD2_TEST_CONCAT(a, b) OBD2_TEST_CONCAT_(a, b)
+
+#define TEST(name) \
+    static void OBD2_TEST_CONCAT(test_, name)(); \
+    static ::obd2::test::registrar OBD2_TEST_CONCAT(registrar_, name)(#name, OBD2_TEST_CONCAT(test_, name)); \
+    static void OBD2_TEST_CONCAT(test_, name)()
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            ::obd2::test::fail(#expr, __FILE__, __LINE__); \
+        } \
+    } while (0)
+
+// Stops the test on failure, for checks that later checks depend on
+#define REQUIRE(expr) \
+    do { \
+        if (!(expr)) { \
+            ::obd2::test::fail(#expr, __FILE__, __LINE__); \
+            return; \
+        } \
+    } while (0)
@@ -0,0 +1,37 @@
+#include "test.h"
+
+namespace obd2::test {
+    namespace {
+        int failures = 0;
+    }
+
+    std::vector<test_case> &registry() {
+        static std::vector<test_case> tests;
+        return tests;
+    }
+
+    void fail(const char *expr, const char *file, int line) {
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+        failures++;
+    }
+}
+
+int main() {
+    int failed_tests = 0;
+
+    for (const obd2::test::test_case &t : obd2::test::registry()) {
+        int failures_before = obd2::test::failures;
+
+        std::printf("[ RUN  ] %s\n", t.name);
+        t.fn();
+
+        bool passed = obd2::test::failures == failures_before;
+        failed_tests += passed ? 0 : 1;
+
+        std::printf("[ %s ] %s\n", passed ? " OK " : "FAIL", t.name);
+    }
+
+    std::printf("%zu tests, %d failed\n", obd2::test::registry().size(), failed_tests);
+
+    return failed_tests == 0 ? 0 : 1;
+}